@@ -62,7 +62,7 @@ static void
 audio_write_callback (pa_stream * stream, size_t size, void *data)
 {
   struct audio *audio = data;
-  guint32 req_frames;
+  guint32 req_frames, loaded;
   void *buffer;
   gint16 *dst, *src;
 
@@ -109,10 +109,19 @@ audio_write_callback (pa_stream * stream, size_t size, void *data)
       return;
     }
 
+  //The sample might still be loading.
+  loaded = g_atomic_int_get (&audio->sample->len) >> audio->channels;
+
   dst = buffer;
   src = (gint16 *) & audio->sample->data[audio->pos << audio->channels];
   for (gint i = 0; i < req_frames; i++)
     {
+      if (audio->pos >= loaded && audio->pos < audio->frames)
+	{
+	  debug_print (2, "Sample not loaded yet\n");
+	  break;
+	}
+
       if (audio->pos == audio->frames)
 	{
 	  if (!audio->loop)
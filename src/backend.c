@@ -18,6 +18,7 @@
  *   along with Elektroid. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <sys/stat.h>
 #include "backend.h"
 #include "local.h"
 
@@ -28,11 +29,37 @@
 #define BE_DEV_RING_BUF_LEN (256 * BE_KB)
 #define BE_DEVICE_NAME "hw:%d,%d,%d"
 #define BE_TMP_BUFF_LEN 256
+#define BE_RTT_MIN_TIMEOUT_MS (2 * BE_POLL_TIMEOUT_MS)
+#define BE_RTT_MIN_SAMPLES 3
+#define BE_RTT_MAX_BACKOFF 6
+#define BE_PROFILE_TAG_TX_LEN "tx_len"
+#define BE_PROFILE_TAG_REST_TIME "rest_time"
+#define BE_PROFILE_TAG_BLOCK_LEN "block_len"
+#define BE_PROFILE_TAG_TIMEOUT "timeout"
+#define BE_PROFILE_MIN_TX_LEN 64
+#define BE_PROFILE_MAX_TX_LEN BE_MAX_TX_LEN
+#define BE_PROFILE_MAX_REST_TIME_US 1000000
+#define BE_PROFILE_MIN_TIMEOUT_MS 100
+#define BE_PROFILE_MAX_TIMEOUT_MS 60000
+#define BE_CALIBRATION_REQUESTS 16
+#define BE_CALIBRATION_BLOCK_LEN BE_MAX_TX_LEN	//Used when the connector does not set a block length.
+#define BE_MIDI_BAUD_RATE 31250
+#define BE_MIDI_BITS_PER_BYTE 10	//Start bit, 8 data bits and stop bit.
 
 //Identity Request Universal Sysex message
 static const guint8 BE_MIDI_IDENTITY_REQUEST[] =
   { 0xf0, 0x7e, 0x7f, 6, 1, 0xf7 };
 
+//Non-commercial manufacturer ID. Devices just read these messages and ignore them.
+static const guint8 BE_CALIBRATION_FILLER_HEADER[] = { 0xf0, 0x7d };
+
+//Candidates in the order they are tried. The first working one is used.
+//Rest times are divisors of the connector default and TX lengths never go
+//beyond BE_MAX_TX_LEN.
+static const guint BE_CALIBRATION_REST_TIME_DIVISORS[] = { 4, 2, 1 };
+static const guint BE_CALIBRATION_TX_LENS[] =
+  { BE_MAX_TX_LEN, BE_MAX_TX_LEN / 2, BE_MAX_TX_LEN / 4, BE_MAX_TX_LEN / 8 };
+
 gdouble
 backend_get_storage_stats_percent (struct backend_storage_stats *statfs)
 {
@@ -92,6 +119,12 @@ backend_destroy (struct backend *backend)
 
   debug_print (1, "Destroying backend...\n");
 
+  //Connectors might still be using the ports from their own threads.
+  if (backend->destroy_data)
+    {
+      backend->destroy_data (backend);
+    }
+
   backend->device_desc.id = -1;
   backend->device_desc.filesystems = 0;
   backend->upgrade_os = NULL;
@@ -132,12 +165,9 @@ backend_destroy (struct backend *backend)
       backend->pfds = NULL;
     }
 
-  if (backend->destroy_data)
-    {
-      backend->destroy_data (backend);
-    }
-
   backend_disable_cache (backend);
+
+  g_mutex_clear (&backend->rtt_mutex);
 }
 
 static void
@@ -230,6 +260,11 @@ backend_init (struct backend *backend, const gchar * id)
   backend->rx_len = 0;
   backend->cache = NULL;
   backend->buffer = NULL;
+  g_mutex_init (&backend->rtt_mutex);
+  memset (backend->rtts, 0, sizeof (backend->rtts));
+  backend_set_default_profile (&backend->profile);
+  backend->default_profile = backend->profile;
+  backend->profile_key[0] = 0;
 
   if (!strcmp (id, BE_SYSTEM_ID))
     {
@@ -355,9 +390,9 @@ backend_tx_sysex_with_state_update (struct backend *backend,
   while (total < transfer->raw->len && transfer->active)
     {
       len = transfer->raw->len - total;
-      if (len > BE_MAX_TX_LEN)
+      if (len > backend->profile.tx_len)
 	{
-	  len = BE_MAX_TX_LEN;
+	  len = backend->profile.tx_len;
 	}
 
       tx_len = backend_tx_raw (backend, b, len);
@@ -726,7 +761,7 @@ backend_tx (struct backend *backend, GByteArray * tx_msg)
   return transfer.err;
 }
 
-//Not synchronized. Only meant to be called from backend_tx_and_rx_sysex_transfer.
+//Not synchronized. Only meant to be called from functions holding the mutex.
 
 static gint
 backend_tx_and_rx_sysex_transfer_no_cache (struct backend *backend,
@@ -803,11 +838,494 @@ backend_tx_and_rx_sysex (struct backend *backend,
 {
   struct sysex_transfer transfer;
   transfer.raw = tx_msg;
-  transfer.timeout = timeout < 0 ? BE_SYSEX_TIMEOUT_MS : timeout;
+  transfer.timeout = timeout < 0 ? backend->profile.timeout : timeout;
   backend_tx_and_rx_sysex_transfer (backend, &transfer, TRUE);
   return transfer.raw;
 }
 
+//Synchronized
+//Timeouts are estimated as in RFC 6298 and the fixed values are only used as
+//ceilings and until there are enough samples.
+
+gint
+backend_get_timeout (struct backend *backend, guint type, gint ceiling)
+{
+  gint timeout;
+  gint64 rto;
+  struct backend_rtt *rtt;
+
+  if (type >= BE_RTT_TYPES || ceiling <= 0)
+    {
+      return ceiling;
+    }
+
+  g_mutex_lock (&backend->rtt_mutex);
+  rtt = &backend->rtts[type];
+  if (rtt->samples < BE_RTT_MIN_SAMPLES)
+    {
+      timeout = ceiling;
+    }
+  else
+    {
+      //The clock granularity is the poll period.
+      rto = rtt->srtt + MAX (BE_POLL_TIMEOUT_MS * 1000, 4 * rtt->rttvar);
+      rto = (rto << rtt->backoff) / 1000;
+      timeout = MIN (MAX (rto, BE_RTT_MIN_TIMEOUT_MS), ceiling);
+    }
+  g_mutex_unlock (&backend->rtt_mutex);
+
+  debug_print (3, "Timeout for request type %d: %d ms\n", type, timeout);
+
+  return timeout;
+}
+
+//Synchronized
+//A negative round trip time means a timeout. Following Karn's algorithm,
+//responses to requests that have been sent more than once must not be used.
+
+void
+backend_update_rtt (struct backend *backend, guint type, gint64 rtt_us)
+{
+  struct backend_rtt *rtt;
+
+  if (type >= BE_RTT_TYPES)
+    {
+      return;
+    }
+
+  g_mutex_lock (&backend->rtt_mutex);
+  rtt = &backend->rtts[type];
+  if (rtt_us < 0)
+    {
+      if (rtt->backoff < BE_RTT_MAX_BACKOFF)
+	{
+	  rtt->backoff++;
+	}
+    }
+  else
+    {
+      if (rtt->samples)
+	{
+	  rtt->rttvar = (3 * rtt->rttvar + llabs (rtt->srtt - rtt_us)) / 4;
+	  rtt->srtt = (7 * rtt->srtt + rtt_us) / 8;
+	}
+      else
+	{
+	  rtt->srtt = rtt_us;
+	  rtt->rttvar = rtt_us / 2;
+	}
+      if (rtt->samples < BE_RTT_MIN_SAMPLES)
+	{
+	  rtt->samples++;
+	}
+      rtt->backoff = 0;
+    }
+  debug_print (3,
+	       "RTT for request type %d: %.1f ms (variance %.1f ms; backoff %d)\n",
+	       type, rtt->srtt / 1000.0, rtt->rttvar / 1000.0, rtt->backoff);
+  g_mutex_unlock (&backend->rtt_mutex);
+}
+
+//Synchronized
+//Only for idempotent requests as the request is sent again with the ceiling
+//as the timeout if there is no response within the estimated timeout.
+//The cache is not used as its responses would spoil the estimation.
+
+GByteArray *
+backend_tx_and_rx_sysex_rtt (struct backend *backend, GByteArray * tx_msg,
+			     guint type, gint ceiling)
+{
+  gint64 start;
+  gint timeout;
+  struct sysex_transfer transfer, dup;
+
+  timeout = backend_get_timeout (backend, type, ceiling);
+
+  g_mutex_lock (&backend->mutex);
+
+  transfer.raw = tx_msg;
+  transfer.timeout = timeout;
+  transfer.batch = FALSE;
+  start = g_get_monotonic_time ();
+  backend_tx_sysex (backend, &transfer);
+  if (!transfer.err)
+    {
+      backend_rx_sysex (backend, &transfer);
+    }
+
+  if (transfer.err == -ETIMEDOUT && timeout < ceiling)
+    {
+      backend_update_rtt (backend, type, -1);
+
+      debug_print (1, "No response after %d ms. Sending request again...\n",
+		   timeout);
+      transfer.raw = tx_msg;
+      transfer.timeout = ceiling;
+      backend_tx_sysex (backend, &transfer);
+      if (!transfer.err)
+	{
+	  backend_rx_sysex (backend, &transfer);
+	}
+
+      //The first response might have been just late so a second one is discarded.
+      if (!transfer.err)
+	{
+	  dup.timeout = timeout;
+	  dup.batch = FALSE;
+	  if (!backend_rx_sysex (backend, &dup))
+	    {
+	      debug_print (1, "Discarding duplicated response...\n");
+	      free_msg (dup.raw);
+	    }
+	}
+    }
+  else if (!transfer.err)
+    {
+      backend_update_rtt (backend, type, g_get_monotonic_time () - start);
+    }
+
+  g_mutex_unlock (&backend->mutex);
+
+  free_msg (tx_msg);
+  return transfer.err ? NULL : transfer.raw;
+}
+
+void
+backend_set_default_profile (struct backend_profile *profile)
+{
+  profile->tx_len = BE_MAX_TX_LEN;
+  profile->rest_time = BE_REST_TIME_US;
+  profile->block_len = 0;
+  profile->timeout = BE_SYSEX_TIMEOUT_MS;
+}
+
+static void
+backend_read_profile_member (JsonReader * reader, const gchar * member,
+			     guint * value, guint min, guint max)
+{
+  if (json_reader_read_member (reader, member))
+    {
+      *value = CLAMP (json_reader_get_int_value (reader), min, max);
+    }
+  json_reader_end_member (reader);
+}
+
+//The reader must be on an object. Missing members are left untouched.
+
+void
+backend_read_profile (JsonReader * reader, struct backend_profile *profile)
+{
+  backend_read_profile_member (reader, BE_PROFILE_TAG_TX_LEN,
+			       &profile->tx_len, BE_PROFILE_MIN_TX_LEN,
+			       BE_PROFILE_MAX_TX_LEN);
+  backend_read_profile_member (reader, BE_PROFILE_TAG_REST_TIME,
+			       &profile->rest_time, 0,
+			       BE_PROFILE_MAX_REST_TIME_US);
+  backend_read_profile_member (reader, BE_PROFILE_TAG_BLOCK_LEN,
+			       &profile->block_len, 0, G_MAXINT);
+  backend_read_profile_member (reader, BE_PROFILE_TAG_TIMEOUT,
+			       &profile->timeout, BE_PROFILE_MIN_TIMEOUT_MS,
+			       BE_PROFILE_MAX_TIMEOUT_MS);
+}
+
+//Connectors call this at the end of the handshake. The key identifies the
+//device in the profiles file and is used when saving the profile.
+
+void
+backend_load_profile (struct backend *backend, const gchar * key)
+{
+  GError *error = NULL;
+  JsonParser *parser;
+  JsonReader *reader;
+  gchar *path = get_expanded_dir (CONF_DIR BE_PROFILES_FILE);
+
+  snprintf (backend->profile_key, LABEL_MAX, "%s", key);
+  backend->default_profile = backend->profile;
+
+  parser = json_parser_new ();
+  if (!json_parser_load_from_file (parser, path, &error))
+    {
+      debug_print (1, "Error while loading profiles from '%s': %s\n",
+		   path, error->message);
+      g_error_free (error);
+      goto end;
+    }
+
+  reader = json_reader_new (json_parser_get_root (parser));
+  if (json_reader_is_object (reader))
+    {
+      if (json_reader_read_member (reader, key)
+	  && json_reader_is_object (reader))
+	{
+	  debug_print (1, "Loading profile for '%s'...\n", key);
+	  backend_read_profile (reader, &backend->profile);
+	}
+      json_reader_end_member (reader);
+    }
+  g_object_unref (reader);
+
+end:
+  debug_print (1,
+	       "Profile for '%s': TX length %d B; rest time %d us; block length %d B; timeout %d ms\n",
+	       backend->profile_key, backend->profile.tx_len,
+	       backend->profile.rest_time, backend->profile.block_len,
+	       backend->profile.timeout);
+  g_object_unref (parser);
+  g_free (path);
+}
+
+gint
+backend_save_profile (struct backend *backend)
+{
+  gint err;
+  gchar *json, *dir, *path;
+  JsonParser *parser;
+  JsonGenerator *gen;
+  JsonNode *root;
+  JsonObject *object, *profile;
+
+  if (!strlen (backend->profile_key))
+    {
+      return -EINVAL;
+    }
+
+  dir = get_expanded_dir (CONF_DIR);
+  if (g_mkdir_with_parents (dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH |
+			    S_IXOTH))
+    {
+      error_print ("Error wile creating directory `%s'\n", CONF_DIR);
+      g_free (dir);
+      return -errno;
+    }
+  g_free (dir);
+
+  path = get_expanded_dir (CONF_DIR BE_PROFILES_FILE);
+  parser = json_parser_new ();
+  if (json_parser_load_from_file (parser, path, NULL)
+      && JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    {
+      root = json_node_copy (json_parser_get_root (parser));
+    }
+  else
+    {
+      root = json_node_new (JSON_NODE_OBJECT);
+      json_node_take_object (root, json_object_new ());
+    }
+  g_object_unref (parser);
+
+  profile = json_object_new ();
+  json_object_set_int_member (profile, BE_PROFILE_TAG_TX_LEN,
+			      backend->profile.tx_len);
+  json_object_set_int_member (profile, BE_PROFILE_TAG_REST_TIME,
+			      backend->profile.rest_time);
+  json_object_set_int_member (profile, BE_PROFILE_TAG_BLOCK_LEN,
+			      backend->profile.block_len);
+  json_object_set_int_member (profile, BE_PROFILE_TAG_TIMEOUT,
+			      backend->profile.timeout);
+
+  object = json_node_get_object (root);
+  json_object_set_object_member (object, backend->profile_key, profile);
+
+  debug_print (1, "Saving profile for '%s' to '%s'...\n",
+	       backend->profile_key, path);
+
+  gen = json_generator_new ();
+  g_object_set (gen, "pretty", TRUE, NULL);
+  json_generator_set_root (gen, root);
+  json = json_generator_to_data (gen, NULL);
+  err = save_file_char (path, (guint8 *) json, strlen (json));
+
+  g_free (json);
+  g_object_unref (gen);
+  json_node_free (root);
+  g_free (path);
+
+  return err;
+}
+
+//A block sized filler message the device must read entirely before answering
+//the identity request that follows it.
+
+static GByteArray *
+backend_calibration_get_msg (guint len)
+{
+  GByteArray *msg = g_byte_array_sized_new (len +
+					    sizeof
+					    (BE_MIDI_IDENTITY_REQUEST));
+
+  len = MAX (len, sizeof (BE_CALIBRATION_FILLER_HEADER) + 1);
+  g_byte_array_append (msg, BE_CALIBRATION_FILLER_HEADER,
+		       sizeof (BE_CALIBRATION_FILLER_HEADER));
+  g_byte_array_set_size (msg, len);
+  memset (&msg->data[sizeof (BE_CALIBRATION_FILLER_HEADER)], 0,
+	  len - sizeof (BE_CALIBRATION_FILLER_HEADER) - 1);
+  msg->data[len - 1] = 0xf7;
+  g_byte_array_append (msg, BE_MIDI_IDENTITY_REQUEST,
+		       sizeof (BE_MIDI_IDENTITY_REQUEST));
+
+  return msg;
+}
+
+//Not synchronized. Only meant to be called from backend_calibrate.
+//Every request is a transfer block and its response, followed by the rest
+//time, as the connectors do while transferring data.
+
+static gint
+backend_calibration_run (struct backend *backend, guint requests,
+			 guint rest_time, guint len)
+{
+  guint responses = 0;
+  struct sysex_transfer transfer;
+  GByteArray *tx_msg = backend_calibration_get_msg (len);
+  //On a MIDI DIN port the message takes this time just to reach the device.
+  gint wire_time = len * BE_MIDI_BITS_PER_BYTE * 1000 / BE_MIDI_BAUD_RATE;
+
+  backend_rx_drain (backend);
+
+  for (; responses < requests; responses++)
+    {
+      transfer.raw = tx_msg;
+      if (backend_tx_sysex (backend, &transfer))
+	{
+	  break;
+	}
+
+      transfer.timeout = BE_SYSEX_TIMEOUT_GUESS_MS + wire_time;
+      transfer.batch = FALSE;
+      if (backend_rx_sysex (backend, &transfer))
+	{
+	  break;
+	}
+      free_msg (transfer.raw);
+
+      usleep (rest_time);
+    }
+
+  free_msg (tx_msg);
+  debug_print (1, "%d responses received out of %d\n", responses, requests);
+  return responses == requests ? 0 : -EIO;
+}
+
+//Not synchronized. Only meant to be called from backend_calibrate.
+
+static gint
+backend_calibration_rtt (struct backend *backend, guint requests,
+			 gint64 * rtt)
+{
+  gint64 start, total = 0;
+  struct sysex_transfer transfer;
+
+  backend_rx_drain (backend);
+
+  for (guint i = 0; i < requests; i++)
+    {
+      transfer.raw = g_byte_array_sized_new (sizeof
+					     (BE_MIDI_IDENTITY_REQUEST));
+      g_byte_array_append (transfer.raw, BE_MIDI_IDENTITY_REQUEST,
+			   sizeof (BE_MIDI_IDENTITY_REQUEST));
+      transfer.timeout = BE_SYSEX_TIMEOUT_GUESS_MS;
+      start = g_get_monotonic_time ();
+      if (backend_tx_and_rx_sysex_transfer_no_cache (backend, &transfer,
+						     TRUE))
+	{
+	  return -EIO;
+	}
+      total += g_get_monotonic_time () - start;
+      free_msg (transfer.raw);
+      usleep (BE_REST_TIME_US);
+    }
+
+  *rtt = total / requests;
+  return 0;
+}
+
+//Synchronized
+//Only the tuning that can be measured without changing anything in the device
+//is done. The block length and the timeout are kept as they are.
+//The requests are as long as the connector transfer blocks and the results
+//never go beyond the connector defaults, which are the values known to work.
+
+gint
+backend_calibrate (struct backend *backend, gint64 * rtt)
+{
+  gint err, i, n;
+  guint rest_time, tx_len, block_len, candidate;
+
+  g_mutex_lock (&backend->mutex);
+
+  debug_print (1, "Measuring round trip time...\n");
+  err = backend_calibration_rtt (backend, BE_CALIBRATION_REQUESTS, rtt);
+  if (err)
+    {
+      error_print ("No response to the MIDI identity request\n");
+      goto end;
+    }
+
+  block_len = backend->profile.block_len ? backend->profile.block_len :
+    backend->default_profile.block_len;
+  block_len = block_len ? block_len : BE_CALIBRATION_BLOCK_LEN;
+  tx_len = backend->profile.tx_len;
+  backend->profile.tx_len = MIN (tx_len, backend->default_profile.tx_len);
+
+  //A rest time is valid if two runs in a row are fine. A margin is added by
+  //using the next candidate.
+  n = G_N_ELEMENTS (BE_CALIBRATION_REST_TIME_DIVISORS);
+  rest_time = backend->default_profile.rest_time;
+  err = -EIO;
+  for (i = 0; i < n; i++)
+    {
+      candidate = backend->default_profile.rest_time /
+	BE_CALIBRATION_REST_TIME_DIVISORS[i];
+      debug_print (1, "Testing rest time %d us with %d B blocks...\n",
+		   candidate, block_len);
+      if (!backend_calibration_run (backend, BE_CALIBRATION_REQUESTS,
+				    candidate, block_len)
+	  && !backend_calibration_run (backend, BE_CALIBRATION_REQUESTS,
+				       candidate, block_len))
+	{
+	  rest_time = backend->default_profile.rest_time /
+	    BE_CALIBRATION_REST_TIME_DIVISORS[MIN (i + 1, n - 1)];
+	  err = 0;
+	  break;
+	}
+    }
+  if (err)
+    {
+      error_print ("No rest time works\n");
+      backend->profile.tx_len = tx_len;
+      goto end;
+    }
+
+  //The same blocks are sent for every TX length so only the length makes the
+  //difference.
+  tx_len = BE_CALIBRATION_TX_LENS[G_N_ELEMENTS (BE_CALIBRATION_TX_LENS) - 1];
+  for (i = 0; i < G_N_ELEMENTS (BE_CALIBRATION_TX_LENS); i++)
+    {
+      if (BE_CALIBRATION_TX_LENS[i] > backend->default_profile.tx_len)
+	{
+	  continue;
+	}
+      debug_print (1, "Testing TX length %d B...\n",
+		   BE_CALIBRATION_TX_LENS[i]);
+      backend->profile.tx_len = BE_CALIBRATION_TX_LENS[i];
+      if (!backend_calibration_run (backend, BE_CALIBRATION_REQUESTS,
+				    rest_time, block_len))
+	{
+	  tx_len = BE_CALIBRATION_TX_LENS[i];
+	  break;
+	}
+    }
+
+  backend->profile.rest_time = rest_time;
+  backend->profile.tx_len = tx_len;
+
+  backend_rx_drain (backend);
+
+end:
+  g_mutex_unlock (&backend->mutex);
+  return err;
+}
+
 gboolean
 backend_check (struct backend *backend)
 {
@@ -951,6 +1469,44 @@ backend_get_system_devices ()
   return devices;
 }
 
+gboolean
+backend_is_usb (struct backend *backend)
+{
+  snd_rawmidi_info_t *info;
+  snd_ctl_card_info_t *card_info;
+  snd_ctl_t *ctl;
+  gchar name[32];
+  gboolean usb = FALSE;
+
+  if (!backend->outputp)
+    {
+      return FALSE;
+    }
+
+  snd_rawmidi_info_alloca (&info);
+  if (snd_rawmidi_info (backend->outputp, info) < 0)
+    {
+      return FALSE;
+    }
+
+  sprintf (name, "hw:%d", snd_rawmidi_info_get_card (info));
+  if (snd_ctl_open (&ctl, name, 0) < 0)
+    {
+      return FALSE;
+    }
+
+  snd_ctl_card_info_alloca (&card_info);
+  if (!snd_ctl_card_info (ctl, card_info))
+    {
+      usb = !strcmp (snd_ctl_card_info_get_driver (card_info), "USB-Audio");
+    }
+  snd_ctl_close (ctl);
+
+  debug_print (1, "Transport: %s\n", usb ? "USB" : "other");
+
+  return usb;
+}
+
 gchar *
 backend_get_fs_ext (const struct device_desc *desc,
 		    const struct fs_operations *ops)
@@ -960,6 +1516,203 @@ backend_get_fs_ext (const struct device_desc *desc,
   return ext;
 }
 
+//The items of a range are transferred with their own job control as the connectors reset the progress on every item.
+//Its progress is mapped into the range one and the cancellations are propagated to it.
+//The callback might run with the item mutex held, so the item control is never locked there. It is only used by the transferring thread, so the state is stored atomically.
+
+struct backend_range_control
+{
+  struct job_control control;	//This must be the first member.
+  struct job_control *parent;
+};
+
+static void
+backend_range_progress (struct job_control *control)
+{
+  gboolean active;
+  struct backend_range_control *range =
+    (struct backend_range_control *) control;
+  struct job_control *parent = range->parent;
+
+  g_mutex_lock (&parent->mutex);
+  parent->progress = (parent->part + control->progress) / parent->parts;
+  active = parent->active;
+  g_mutex_unlock (&parent->mutex);
+
+  g_atomic_int_set (&control->active, active);
+
+  if (parent->callback)
+    {
+      parent->callback (parent);
+    }
+}
+
+//Generic range loop. Connectors implementing the range operations usually call this after setting up the shared state.
+//Items not found while downloading are skipped so a range can contain empty slots.
+
+gint
+backend_run_range (struct backend *backend, GPtrArray * paths,
+		   fs_remote_file_op op, gboolean upload,
+		   fs_range_item_func item, struct job_control *control,
+		   void *data)
+{
+  gint err = 0;
+  gboolean active;
+  const gchar *path;
+  GByteArray *array;
+  struct backend_range_control range;
+
+  range.parent = control;
+  range.control.callback = backend_range_progress;
+  g_mutex_init (&range.control.mutex);
+
+  control->parts = paths->len;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  for (guint i = 0; i < paths->len; i++)
+    {
+      g_mutex_lock (&control->mutex);
+      control->part = i;
+      active = control->active;
+      g_mutex_unlock (&control->mutex);
+
+      if (!active)
+	{
+	  err = -ECANCELED;
+	  break;
+	}
+
+      path = g_ptr_array_index (paths, i);
+      debug_print (1, "Transferring range item %d/%d (%s)...\n", i + 1,
+		   paths->len, path);
+
+      range.control.active = active;
+      range.control.parts = 1;
+      range.control.part = 0;
+      range.control.progress = 0.0;
+      range.control.data = NULL;
+
+      array = g_byte_array_new ();
+      if (upload)
+	{
+	  err = item (path, i, array, &range.control, data);
+	  if (!err)
+	    {
+	      err = op (backend, path, array, &range.control);
+	    }
+	}
+      else
+	{
+	  err = op (backend, path, array, &range.control);
+	  if (!err)
+	    {
+	      err = item (path, i, array, &range.control, data);
+	    }
+	  else if (err == -ENOENT)
+	    {
+	      debug_print (1, "Item %s not found. Skipping...\n", path);
+	      err = 0;
+	    }
+	}
+      g_byte_array_free (array, TRUE);
+      g_free (range.control.data);
+
+      if (err)
+	{
+	  if (err != -ECANCELED)
+	    {
+	      error_print ("Error while transferring %s: %s\n", path,
+			   g_strerror (-err));
+	    }
+	  break;
+	}
+    }
+
+  if (!err && paths->len)
+    {
+      control->part = paths->len - 1;
+      set_job_control_progress (control, 1.0);
+    }
+
+  g_mutex_clear (&range.control.mutex);
+
+  return err;
+}
+
+gint
+backend_download_range (struct backend *backend,
+			const struct fs_operations *ops, GPtrArray * paths,
+			fs_range_item_func item, struct job_control *control,
+			void *data)
+{
+  if (ops->download_range)
+    {
+      return ops->download_range (backend, paths, item, control, data);
+    }
+
+  return backend_run_range (backend, paths, ops->download, FALSE, item,
+			    control, data);
+}
+
+gint
+backend_upload_range (struct backend *backend,
+		      const struct fs_operations *ops, GPtrArray * paths,
+		      fs_range_item_func item, struct job_control *control,
+		      void *data)
+{
+  if (ops->upload_range)
+    {
+      return ops->upload_range (backend, paths, item, control, data);
+    }
+
+  return backend_run_range (backend, paths, ops->upload, TRUE, item,
+			    control, data);
+}
+
+//Download paths are set in advance as some connectors hold the backend while transferring ranges.
+//Every item of a range is in the same directory so it is read only once. Slot storage filesystems do not depend on the iterator position to get the download paths.
+
+gint
+backend_get_download_range_paths (struct backend *backend,
+				  const struct fs_operations *ops,
+				  GPtrArray * paths, const gchar * dst_dir,
+				  GPtrArray * dst_paths)
+{
+  gint err;
+  gchar *src_dir, *download_path;
+  struct item_iterator iter;
+
+  if (!paths->len)
+    {
+      return 0;
+    }
+
+  src_dir = g_path_get_dirname (g_ptr_array_index (paths, 0));
+  err = ops->readdir (backend, &iter, src_dir);
+  g_free (src_dir);
+  if (err)
+    {
+      return err;
+    }
+
+  for (guint i = 0; i < paths->len; i++)
+    {
+      download_path = ops->get_download_path (backend, &iter, ops, dst_dir,
+					      g_ptr_array_index (paths, i));
+      if (!download_path)
+	{
+	  err = -EINVAL;
+	  break;
+	}
+      g_ptr_array_add (dst_paths, download_path);
+    }
+
+  free_item_iterator (&iter);
+
+  return err;
+}
+
 void
 backend_destroy_data (struct backend *backend)
 {
@@ -34,6 +34,8 @@
 #define BE_SYSEX_TIMEOUT_MS 5000
 #define BE_SYSEX_TIMEOUT_GUESS_MS 500	//When the request is not implemented, 5 s is too much.
 #define BE_SAMPLE_ID_NAME_SEPARATOR ":"
+#define BE_RTT_TYPES 8		//Request types a connector can use to estimate timeouts.
+#define BE_PROFILES_FILE "/profiles.json"
 
 #define BE_COMPANY_LEN 3
 #define BE_FAMILY_LEN 2
@@ -62,6 +64,25 @@ struct backend_midi_info
   gchar version[BE_VERSION_LEN];
 };
 
+//Transfer tuning. Connectors might change the defaults at handshake before
+//loading the user profile, which is written by elektroid-cli calibrate.
+struct backend_profile
+{
+  guint tx_len;			//Bytes written to the device at once
+  guint rest_time;		//Microseconds between transfer blocks
+  guint block_len;		//Bytes per transfer block. 0 means the connector default.
+  guint timeout;		//Default response timeout in milliseconds
+};
+
+//Round trip time estimation of a request type. Times are in microseconds.
+struct backend_rtt
+{
+  gint64 srtt;
+  gint64 rttvar;
+  guint samples;
+  guint backoff;
+};
+
 enum backend_type
 {
   BE_TYPE_NONE,
@@ -86,10 +107,17 @@ struct backend
   gchar device_name[LABEL_MAX];
   //Message cache
   GHashTable *cache;
+  //Round trip times indexed by the connector request types
+  GMutex rtt_mutex;
+  struct backend_rtt rtts[BE_RTT_TYPES];
+  //Transfer tuning
+  struct backend_profile profile;
+  struct backend_profile default_profile;	//Set by the connector. Calibration stays within it.
+  gchar profile_key[LABEL_MAX];
   //These must be filled by the concrete backend.
   const struct fs_operations **fs_ops;
   t_destroy_data destroy_data;
-  t_sysex_transfer upgrade_os;
+  t_upgrade_os upgrade_os;
   t_get_storage_stats get_storage_stats;
   void *data;
 };
@@ -119,6 +147,23 @@ gint backend_tx_and_rx_sysex_transfer (struct backend *,
 
 GByteArray *backend_tx_and_rx_sysex (struct backend *, GByteArray *, gint);
 
+gint backend_get_timeout (struct backend *, guint, gint);
+
+void backend_update_rtt (struct backend *, guint, gint64);
+
+GByteArray *backend_tx_and_rx_sysex_rtt (struct backend *, GByteArray *,
+					 guint, gint);
+
+void backend_set_default_profile (struct backend_profile *);
+
+void backend_read_profile (JsonReader *, struct backend_profile *);
+
+void backend_load_profile (struct backend *, const gchar *);
+
+gint backend_save_profile (struct backend *);
+
+gint backend_calibrate (struct backend *, gint64 *);
+
 void backend_rx_drain (struct backend *);
 
 gboolean backend_check (struct backend *);
@@ -129,6 +174,8 @@ void backend_disable_cache (struct backend *);
 
 GArray *backend_get_system_devices ();
 
+gboolean backend_is_usb (struct backend *);
+
 const struct fs_operations *backend_get_fs_operations (struct backend *, gint,
 						       const char *);
 
@@ -139,6 +186,23 @@ gchar *backend_get_fs_ext (const struct device_desc *,
 
 gdouble backend_get_storage_stats_percent (struct backend_storage_stats *);
 
+gint backend_run_range (struct backend *, GPtrArray *, fs_remote_file_op,
+		       gboolean, fs_range_item_func, struct job_control *,
+		       void *);
+
+gint backend_download_range (struct backend *, const struct fs_operations *,
+			     GPtrArray *, fs_range_item_func,
+			     struct job_control *, void *);
+
+gint backend_upload_range (struct backend *, const struct fs_operations *,
+			   GPtrArray *, fs_range_item_func,
+			   struct job_control *, void *);
+
+gint backend_get_download_range_paths (struct backend *,
+				       const struct fs_operations *,
+				       GPtrArray *, const gchar *,
+				       GPtrArray *);
+
 void backend_destroy_data (struct backend *);
 
 gint backend_program_change (struct backend *, guint8, guint8);
@@ -120,6 +120,10 @@ void
 browser_refresh (GtkWidget * object, gpointer data)
 {
   struct browser *browser = data;
+  //Done by the loading thread right before reading the directory.
+  g_mutex_lock (&browser->mutex);
+  browser->refresh = TRUE;
+  g_mutex_unlock (&browser->mutex);
   g_idle_add (browser_load_dir, browser);
 }
 
@@ -301,9 +305,22 @@ static gpointer
 browser_load_dir_runner (gpointer data)
 {
   gint err;
+  gboolean refresh;
   struct browser *browser = data;
 
   g_idle_add (browser_load_dir_runner_show_spinner, browser);
+
+  g_mutex_lock (&browser->mutex);
+  refresh = browser->refresh;
+  browser->refresh = FALSE;
+  g_mutex_unlock (&browser->mutex);
+
+  //Connectors that keep the directory contents in memory must forget them.
+  if (refresh && browser->fs_ops->refresh && browser->backend)
+    {
+      browser->fs_ops->refresh (browser->backend, browser->dir);
+    }
+
   browser->iter = g_malloc (sizeof (struct item_iterator));
   err = browser->fs_ops->readdir (browser->backend, browser->iter,
 				  browser->dir);
@@ -69,6 +69,7 @@ struct browser
   GThread *thread;
   GMutex mutex;
   gboolean active;
+  gboolean refresh;
   struct item_iterator *iter;
 };
 
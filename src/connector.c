@@ -46,6 +46,7 @@ default_handshake (struct backend *backend)
     {
       snprintf (backend->device_name, LABEL_MAX, "%s", _("MIDI device"));
     }
+  backend_load_profile (backend, backend->device_name);
   return 0;
 }
 
@@ -53,31 +54,43 @@ struct connector
 {
   gint (*handshake) (struct backend * backend);
   const gchar *name;
+  const struct fs_operations **fs_ops;
 };
 
 static const struct connector CONNECTOR_ELEKTRON = {
   .handshake = elektron_handshake,
-  .name = "elektron"
+  .name = "elektron",
+  .fs_ops = FS_ELEKTRON_OPERATIONS
 };
 
 static const struct connector CONNECTOR_MICROBRUTE = {
   .handshake = microbrute_handshake,
-  .name = "microbrute"
+  .name = "microbrute",
+  .fs_ops = FS_MICROBRUTE_OPERATIONS_LIST
 };
 
 static const struct connector CONNECTOR_CZ = {
   .handshake = cz_handshake,
-  .name = "cz"
+  .name = "cz",
+  .fs_ops = FS_CZ_OPERATIONS
 };
 
 static const struct connector CONNECTOR_SDS = {
   .handshake = sds_handshake,
-  .name = "sds"
+  .name = "sds",
+  .fs_ops = FS_SDS_ALL_OPERATIONS
 };
 
 static const struct connector CONNECTOR_EFACTOR = {
   .handshake = efactor_handshake,
-  .name = "efactor"
+  .name = "efactor",
+  .fs_ops = FS_EFACTOR_OPERATIONS_LIST
+};
+
+static const struct connector CONNECTOR_SYSTEM = {
+  .handshake = system_handshake,
+  .name = "system",
+  .fs_ops = FS_SYSTEM_OPERATIONS
 };
 
 static const struct connector CONNECTOR_DEFAULT = {
@@ -92,6 +105,14 @@ static const struct connector *CONNECTORS[] = {
   &CONNECTOR_EFACTOR, &CONNECTOR_DEFAULT, NULL
 };
 
+// The system connector is not used for MIDI devices but its filesystems are
+// available to the offline commands.
+
+static const struct connector *OFFLINE_CONNECTORS[] = {
+  &CONNECTOR_MICROBRUTE, &CONNECTOR_ELEKTRON, &CONNECTOR_CZ, &CONNECTOR_SDS,
+  &CONNECTOR_EFACTOR, &CONNECTOR_SYSTEM, NULL
+};
+
 // A handshake function might return these values:
 // 0, the device matches the connector.
 // -ENODEV, the device does not match the connector but we can continue with the next connector.
@@ -175,3 +196,28 @@ end:
   backend_destroy (backend);
   return err;
 }
+
+const struct fs_operations *
+connector_get_fs_operations (const gchar * conn_name, const gchar * fs_name)
+{
+  const struct connector **connector;
+  const struct fs_operations **fs_ops;
+
+  for (connector = OFFLINE_CONNECTORS; *connector; connector++)
+    {
+      if (strcmp (conn_name, (*connector)->name))
+	{
+	  continue;
+	}
+
+      for (fs_ops = (*connector)->fs_ops; *fs_ops; fs_ops++)
+	{
+	  if (!strcmp (fs_name, (*fs_ops)->name))
+	    {
+	      return *fs_ops;
+	    }
+	}
+    }
+
+  return NULL;
+}
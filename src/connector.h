@@ -27,4 +27,7 @@ gint connector_init (struct backend *backend, const gchar * midi_id,
 		     const gchar * name,
 		     struct sysex_transfer *sysex_transfer);
 
+const struct fs_operations *connector_get_fs_operations (const gchar *,
+							  const gchar *);
+
 #endif
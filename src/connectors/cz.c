@@ -32,6 +32,9 @@
 #define CZ_PANEL_ID 0x60
 #define CZ_FIRST_CARTRIDGE_ID 0x40
 #define CZ_PANEL_PATH "/panel"
+#define CZ_MEM_TYPES_NUM 3
+#define CZ_BANK_REQUESTS_AHEAD 1	//Requests sent before the previous dump is received.
+#define CZ_RTT_PROGRAM 0	//Request type for the timeout estimation
 
 static const char *CZ_MEM_TYPES[] =
   { "preset", "internal", "cartridge", NULL };
@@ -44,7 +47,20 @@ static const guint8 CZ_PROGRAM_HEADER[] =
 
 enum cz_fs
 {
-  FS_PROGRAM_CZ = 1
+  FS_PROGRAM_CZ = 1,
+  FS_BANK_CZ = 2
+};
+
+enum cz_cartridge
+{
+  CZ_CARTRIDGE_UNKNOWN = 0,
+  CZ_CARTRIDGE_ABSENT,
+  CZ_CARTRIDGE_PRESENT
+};
+
+struct cz_data
+{
+  enum cz_cartridge cartridge;
 };
 
 struct cz_type_iterator_data
@@ -90,6 +106,42 @@ cz_get_program_dump_msg (guint8 id)
   return tx_msg;
 }
 
+//Probing the cartridge takes up to BE_SYSEX_TIMEOUT_GUESS_MS when there is none so the result is kept until a refresh.
+static gboolean
+cz_has_cartridge (struct backend *backend)
+{
+  GByteArray *tx_msg, *rx_msg;
+  struct cz_data *data = backend->data;
+
+  if (data->cartridge == CZ_CARTRIDGE_UNKNOWN)
+    {
+      tx_msg = cz_get_program_dump_msg (CZ_FIRST_CARTRIDGE_ID);
+      rx_msg = backend_tx_and_rx_sysex (backend, tx_msg,
+					BE_SYSEX_TIMEOUT_GUESS_MS);
+      if (rx_msg)
+	{
+	  free_msg (rx_msg);
+	  data->cartridge = CZ_CARTRIDGE_PRESENT;
+	}
+      else
+	{
+	  data->cartridge = CZ_CARTRIDGE_ABSENT;
+	}
+      debug_print (1, "Cartridge: %s\n",
+		   data->cartridge == CZ_CARTRIDGE_PRESENT ? "yes" : "no");
+    }
+
+  return data->cartridge == CZ_CARTRIDGE_PRESENT;
+}
+
+static gint
+cz_refresh (struct backend *backend, const gchar * path)
+{
+  struct cz_data *data = backend->data;
+  data->cartridge = CZ_CARTRIDGE_UNKNOWN;
+  return 0;
+}
+
 static guint
 cz_next_dentry_root (struct item_iterator *iter)
 {
@@ -104,14 +156,9 @@ cz_next_dentry_root (struct item_iterator *iter)
 
       if (data->next == 2)
 	{
-	  GByteArray *tx_msg =
-	    cz_get_program_dump_msg (CZ_FIRST_CARTRIDGE_ID);
-	  GByteArray *rx_msg = backend_tx_and_rx_sysex (data->backend, tx_msg,
-							BE_SYSEX_TIMEOUT_GUESS_MS);
 	  data->next++;
-	  if (rx_msg)
+	  if (cz_has_cartridge (data->backend))
 	    {
-	      free_msg (rx_msg);
 	      return 0;
 	    }
 	}
@@ -227,51 +274,42 @@ cz_read_dir (struct backend *backend, struct item_iterator *iter,
 }
 
 static gint
-cz_download (struct backend *backend, const gchar * path,
-	     GByteArray * output, struct job_control *control)
+cz_get_download_id (const gchar * path, guint8 * id)
 {
-  guint8 id;
-  gboolean active;
-  gint len, type, err = 0;
-  GByteArray *tx_msg, *rx_msg;
+  gint type;
   gchar *dirname_copy, *dir, *basename_copy;
 
-  control->parts = 1;
-  control->part = 0;
-  set_job_control_progress (control, 0.0);
-
-  if (strcmp (path, CZ_PANEL_PATH))
+  if (!strcmp (path, CZ_PANEL_PATH))
     {
-      dirname_copy = strdup (path);
-      dir = dirname (dirname_copy);
-      type = get_mem_type (&dir[1]);
-      g_free (dirname_copy);
-      if (type < 0)
-	{
-	  err = -EINVAL;
-	  goto end;
-	}
-
-      basename_copy = strdup (path);
-      id = atoi (basename (basename_copy)) - 1 + type * CZ_MEM_TYPE_OFFSET;
-      g_free (basename_copy);
-    }
-  else
-    {
-      id = CZ_PANEL_ID;
+      *id = CZ_PANEL_ID;
+      return 0;
     }
 
-  tx_msg = cz_get_program_dump_msg (id);
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
-  if (!rx_msg)
+  dirname_copy = strdup (path);
+  dir = dirname (dirname_copy);
+  type = get_mem_type (&dir[1]);
+  g_free (dirname_copy);
+  if (type < 0)
     {
-      return -EIO;
+      return -EINVAL;
     }
-  len = rx_msg->len;
-  if (len != CZ_PROGRAM_LEN)
+
+  basename_copy = strdup (path);
+  *id = atoi (basename (basename_copy)) - 1 + type * CZ_MEM_TYPE_OFFSET;
+  g_free (basename_copy);
+
+  return 0;
+}
+
+static gint
+cz_download_append (GByteArray * rx_msg, guint8 id, GByteArray * output,
+		    struct job_control *control)
+{
+  gboolean active;
+
+  if (rx_msg->len != CZ_PROGRAM_LEN)
     {
-      err = -EINVAL;
-      goto cleanup;
+      return -EINVAL;
     }
 
   g_byte_array_append (output, CZ_PROGRAM_HEADER, sizeof (CZ_PROGRAM_HEADER));
@@ -286,21 +324,49 @@ cz_download (struct backend *backend, const gchar * path,
   if (active)
     {
       set_job_control_progress (control, 1.0);
+      return 0;
     }
   else
     {
-      err = -ECANCELED;
+      return -ECANCELED;
     }
+}
 
-cleanup:
+static gint
+cz_download (struct backend *backend, const gchar * path,
+	     GByteArray * output, struct job_control *control)
+{
+  guint8 id;
+  gint err;
+  GByteArray *tx_msg, *rx_msg;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  err = cz_get_download_id (path, &id);
+  if (err)
+    {
+      return err;
+    }
+
+  tx_msg = cz_get_program_dump_msg (id);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, CZ_RTT_PROGRAM,
+					backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
+
+  err = cz_download_append (rx_msg, id, output, control);
   free_msg (rx_msg);
-end:
+
   return err;
 }
 
 static gint
-cz_upload (struct backend *backend, const gchar * path, GByteArray * input,
-	   struct job_control *control)
+cz_upload_locked (struct backend *backend, const gchar * path,
+		  GByteArray * input, struct job_control *control)
 {
   guint8 id;
   gboolean active;
@@ -330,8 +396,6 @@ cz_upload (struct backend *backend, const gchar * path, GByteArray * input,
 	}
     }
 
-  g_mutex_lock (&backend->mutex);
-
   control->parts = 1;
   control->part = 0;
   set_job_control_progress (control, 0.0);
@@ -360,11 +424,342 @@ cz_upload (struct backend *backend, const gchar * path, GByteArray * input,
     }
 
 cleanup:
-  g_mutex_unlock (&backend->mutex);
   g_free (dir_copy);
   return err;
 }
 
+static gint
+cz_upload (struct backend *backend, const gchar * path, GByteArray * input,
+	   struct job_control *control)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  err = cz_upload_locked (backend, path, input, control);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
+}
+
+static guint
+cz_bank_next_dentry (struct item_iterator *iter)
+{
+  struct cz_type_iterator_data *data = iter->data;
+
+  if (data->next == 2 && !cz_has_cartridge (data->backend))
+    {
+      data->next++;
+    }
+
+  if (data->next >= CZ_MEM_TYPES_NUM)
+    {
+      return -ENOENT;
+    }
+
+  iter->item.id = data->next;
+  snprintf (iter->item.name, LABEL_MAX, "%s", CZ_MEM_TYPES[data->next]);
+  iter->item.type = ELEKTROID_FILE;
+  iter->item.size = CZ_PROGRAM_LEN_FIXED * CZ_MAX_PROGRAMS;
+  data->next++;
+
+  return 0;
+}
+
+static gint
+cz_bank_read_dir (struct backend *backend, struct item_iterator *iter,
+		  const gchar * path)
+{
+  struct cz_type_iterator_data *data;
+
+  if (strcmp (path, "/"))
+    {
+      return -ENOTDIR;
+    }
+
+  data = g_malloc (sizeof (struct cz_type_iterator_data));
+  data->next = 0;
+  data->type = -1;
+  data->backend = backend;
+  iter->data = data;
+  iter->next = cz_bank_next_dentry;
+  iter->free = g_free;
+
+  return 0;
+}
+
+static gchar *
+cz_bank_get_download_path (struct backend *backend,
+			   struct item_iterator *remote_iter,
+			   const struct fs_operations *ops,
+			   const gchar * dst_dir, const gchar * src_path)
+{
+  guint type;
+  gchar *name;
+
+  if (common_slot_get_id_name_from_path (src_path, &type, NULL)
+      || type >= CZ_MEM_TYPES_NUM)
+    {
+      return NULL;
+    }
+
+  name = malloc (PATH_MAX);
+  snprintf (name, PATH_MAX, "%s/%s %s.syx", dst_dir, CZ_PRESET_PREFIX,
+	    CZ_MEM_TYPES[type]);
+  return name;
+}
+
+static gint
+cz_bank_tx_request (struct backend *backend, guint8 id)
+{
+  gint err;
+  struct sysex_transfer transfer;
+
+  transfer.raw = cz_get_program_dump_msg (id);
+  err = backend_tx_sysex (backend, &transfer);
+  free_msg (transfer.raw);
+
+  return err < 0 ? err : 0;
+}
+
+//The whole bank is read while holding the backend so there is a single drain and the next request is sent before the
+//current dump is received. The output is the 16 programs in the same format used by the program filesystem.
+static gint
+cz_bank_dump (struct backend *backend, guint type, GByteArray * output,
+	      struct job_control *control, guint ahead)
+{
+  guint8 id = type * CZ_MEM_TYPE_OFFSET;
+  guint requested = 0;
+  gboolean active = TRUE;
+  gint err = 0;
+  struct sysex_transfer transfer;
+
+  g_mutex_lock (&backend->mutex);
+  backend_rx_drain (backend);
+
+  for (guint i = 0; i < CZ_MAX_PROGRAMS && active; i++)
+    {
+      while (requested < CZ_MAX_PROGRAMS && requested <= i + ahead)
+	{
+	  err = cz_bank_tx_request (backend, id + requested);
+	  if (err)
+	    {
+	      goto end;
+	    }
+	  requested++;
+	}
+
+      transfer.timeout = backend->profile.timeout;
+      transfer.batch = FALSE;
+      backend_rx_sysex (backend, &transfer);
+      if (!transfer.raw)
+	{
+	  err = -EIO;
+	  goto end;
+	}
+
+      if (transfer.raw->len != CZ_PROGRAM_LEN)
+	{
+	  free_msg (transfer.raw);
+	  err = -EINVAL;
+	  goto end;
+	}
+
+      g_byte_array_append (output, CZ_PROGRAM_HEADER,
+			   sizeof (CZ_PROGRAM_HEADER));
+      g_byte_array_append (output,
+			   &transfer.raw->data[CZ_PROGRAM_HEADER_OFFSET],
+			   CZ_PROGRAM_LEN - CZ_PROGRAM_HEADER_OFFSET);
+      output->data[output->len - CZ_PROGRAM_LEN_FIXED +
+		   CZ_PROGRAM_HEADER_ID] = id + i;
+      free_msg (transfer.raw);
+
+      set_job_control_progress (control, (i + 1) / (gdouble) CZ_MAX_PROGRAMS);
+
+      g_mutex_lock (&control->mutex);
+      active = control->active;
+      g_mutex_unlock (&control->mutex);
+    }
+
+  if (!active)
+    {
+      err = -ECANCELED;
+    }
+
+end:
+  //Canceled dumps might still have requests ahead.
+  if (err)
+    {
+      backend_rx_drain (backend);
+    }
+  g_mutex_unlock (&backend->mutex);
+  return err;
+}
+
+static gint
+cz_bank_download (struct backend *backend, const gchar * path,
+		  GByteArray * output, struct job_control *control)
+{
+  gint err;
+  guint type;
+
+  if (common_slot_get_id_name_from_path (path, &type, NULL)
+      || type >= CZ_MEM_TYPES_NUM)
+    {
+      return -EINVAL;
+    }
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  err = cz_bank_dump (backend, type, output, control,
+		      CZ_BANK_REQUESTS_AHEAD);
+  if (err == -EIO || err == -EINVAL)
+    {
+      debug_print (1, "Overlapped requests failed. Retrying one by one...\n");
+      g_byte_array_set_size (output, 0);
+      err = cz_bank_dump (backend, type, output, control, 0);
+    }
+
+  return err;
+}
+
+static gint
+cz_bank_upload (struct backend *backend, const gchar * path,
+		GByteArray * input, struct job_control *control)
+{
+  guint type;
+  gint err = 0;
+  gboolean active = TRUE;
+  struct sysex_transfer transfer;
+
+  if (common_slot_get_id_name_from_path (path, &type, NULL)
+      || type >= CZ_MEM_TYPES_NUM)
+    {
+      return -EINVAL;
+    }
+
+  if (input->len != CZ_PROGRAM_LEN_FIXED * CZ_MAX_PROGRAMS)
+    {
+      error_print ("Bad bank\n");
+      return -EBADMSG;
+    }
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  g_mutex_lock (&backend->mutex);
+  for (guint i = 0; i < CZ_MAX_PROGRAMS && active; i++)
+    {
+      transfer.raw = g_byte_array_sized_new (CZ_PROGRAM_LEN_FIXED);
+      g_byte_array_append (transfer.raw,
+			   &input->data[i * CZ_PROGRAM_LEN_FIXED],
+			   CZ_PROGRAM_LEN_FIXED);
+      transfer.raw->data[CZ_PROGRAM_HEADER_ID] =
+	type * CZ_MEM_TYPE_OFFSET + i;
+      err = backend_tx_sysex (backend, &transfer);
+      free_msg (transfer.raw);
+      if (err < 0)
+	{
+	  break;
+	}
+      err = 0;
+
+      set_job_control_progress (control, (i + 1) / (gdouble) CZ_MAX_PROGRAMS);
+
+      g_mutex_lock (&control->mutex);
+      active = control->active;
+      g_mutex_unlock (&control->mutex);
+
+      //The device needs some time to store every program.
+      if (i < CZ_MAX_PROGRAMS - 1)
+	{
+	  usleep (backend->profile.rest_time);
+	}
+    }
+  g_mutex_unlock (&backend->mutex);
+
+  if (!err && !active)
+    {
+      err = -ECANCELED;
+    }
+
+  return err;
+}
+
+//Used in ranges, where the caller holds the backend.
+static gint
+cz_download_locked (struct backend *backend, const gchar * path,
+		    GByteArray * output, struct job_control *control)
+{
+  guint8 id;
+  gint err;
+  struct sysex_transfer transfer;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  err = cz_get_download_id (path, &id);
+  if (err)
+    {
+      return err;
+    }
+
+  err = cz_bank_tx_request (backend, id);
+  if (err)
+    {
+      return err;
+    }
+
+  transfer.timeout = backend->profile.timeout;
+  transfer.batch = FALSE;
+  backend_rx_sysex (backend, &transfer);
+  if (!transfer.raw)
+    {
+      return -EIO;
+    }
+
+  err = cz_download_append (transfer.raw, id, output, control);
+  free_msg (transfer.raw);
+
+  return err;
+}
+
+//Programs in a range are transferred while holding the backend so there is a single drain and no other message can get
+//in between.
+static gint
+cz_download_range (struct backend *backend, GPtrArray * paths,
+		   fs_range_item_func item, struct job_control *control,
+		   void *data)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  backend_rx_drain (backend);
+  err = backend_run_range (backend, paths, cz_download_locked, FALSE, item,
+			   control, data);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
+}
+
+static gint
+cz_upload_range (struct backend *backend, GPtrArray * paths,
+		 fs_range_item_func item, struct job_control *control,
+		 void *data)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  err = backend_run_range (backend, paths, cz_upload_locked, TRUE, item,
+			   control, data);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
+}
+
 static void
 cz_print (struct item_iterator *iter, struct backend *backend)
 {
@@ -381,8 +776,11 @@ static const struct fs_operations FS_PROGRAM_CZ_OPERATIONS = {
   .gui_icon = BE_FILE_ICON_SND,
   .readdir = cz_read_dir,
   .print_item = cz_print,
+  .refresh = cz_refresh,
   .download = cz_download,
   .upload = cz_upload,
+  .download_range = cz_download_range,
+  .upload_range = cz_upload_range,
   .get_id = get_item_name,
   .load = load_file,
   .save = save_file,
@@ -392,8 +790,28 @@ static const struct fs_operations FS_PROGRAM_CZ_OPERATIONS = {
   .type_ext = "syx"
 };
 
-static const struct fs_operations *FS_CZ_OPERATIONS[] = {
-  &FS_PROGRAM_CZ_OPERATIONS, NULL
+static const struct fs_operations FS_BANK_CZ_OPERATIONS = {
+  .fs = FS_BANK_CZ,
+  .options = FS_OPTION_SINGLE_OP | FS_OPTION_SLOT_STORAGE,
+  .name = "bank",
+  .gui_name = "Banks",
+  .gui_icon = BE_FILE_ICON_SND,
+  .readdir = cz_bank_read_dir,
+  .print_item = cz_print,
+  .refresh = cz_refresh,
+  .download = cz_bank_download,
+  .upload = cz_bank_upload,
+  .get_id = get_item_index,
+  .load = load_file,
+  .save = save_file,
+  .get_ext = backend_get_fs_ext,
+  .get_upload_path = common_slot_get_upload_path,
+  .get_download_path = cz_bank_get_download_path,
+  .type_ext = "syx"
+};
+
+const struct fs_operations *FS_CZ_OPERATIONS[] = {
+  &FS_PROGRAM_CZ_OPERATIONS, &FS_BANK_CZ_OPERATIONS, NULL
 };
 
 gint
@@ -416,9 +834,12 @@ cz_handshake (struct backend *backend)
       goto end;
     }
 
-  backend->device_desc.filesystems = FS_PROGRAM_CZ;
+  backend->device_desc.filesystems = FS_PROGRAM_CZ | FS_BANK_CZ;
   backend->fs_ops = FS_CZ_OPERATIONS;
+  backend->data = g_malloc0 (sizeof (struct cz_data));
+  backend->destroy_data = backend_destroy_data;
   snprintf (backend->device_name, LABEL_MAX, "Casio CZ-101");
+  backend_load_profile (backend, backend->device_name);
 
 end:
   free_msg (rx_msg);
@@ -23,6 +23,8 @@
 
 #include "backend.h"
 
+extern const struct fs_operations *FS_CZ_OPERATIONS[];
+
 gint cz_handshake (struct backend *);
 
 #endif
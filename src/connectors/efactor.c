@@ -33,6 +33,9 @@
 #define EFACTOR_H9_NAME_PREFIX "Eventide H9"
 
 #define EFACTOR_PRESET_LINE_SEPARATOR "\x0d\x0a"
+#define EFACTOR_PRESET_LINES 7
+#define EFACTOR_PRESET_NAME_LINE 6
+#define EFACTOR_BANK_NAME "All presets"
 
 #define EFACTOR_OP_PRESETS_WANT 0x48
 #define EFACTOR_OP_PROGRAM_WANT 0x4e
@@ -46,6 +49,10 @@
 
 #define EFACTOR_TIMEOUT_TOTAL_PRESETS 20000	//This takes more than 10s for 100 presets.
 
+//Request types for the timeout estimation
+#define EFACTOR_RTT_GET 0
+#define EFACTOR_RTT_PRESETS 1
+
 #define EFACTOR_PEDAL_NAME(data) (data->type == EFACTOR_FACTOR ? EFACTOR_FACTOR_NAME_PREFIX : EFACTOR_H9_NAME_PREFIX)
 
 static const guint8 EVENTIDE_ID[] = { 0x1c };
@@ -75,7 +82,12 @@ struct efactor_data
   //In the efactor case, the only way to get a single preset is by getting the panel, which needs a preset to be loaded
   // but won't work properly if there are preset mappings. So we read all the memory -we were reading it anyway- and
   // use it to get the download data from there.
-  gchar **lines;
+  //Every element is a NULL terminated array with the lines of a preset. This is kept up to date on uploads and renames
+  //so the device is only read again after an explicit refresh.
+  GPtrArray *preset_table;
+  gboolean read_before;
+  //Presets queued while uploading a range.
+  GPtrArray *pending;
 };
 
 struct efactor_iter_data
@@ -87,7 +99,8 @@ struct efactor_iter_data
 
 enum efactor_fs
 {
-  FS_EFACTOR_PRESET = 1
+  FS_EFACTOR_PRESET = 1,
+  FS_EFACTOR_BANK = 2
 };
 
 static GByteArray *
@@ -115,38 +128,148 @@ efactor_new_get_msg (guint8 type, const gchar * key)
   return tx_msg;
 }
 
+//The preset table is always loaded when reading the directory so the name is
+//taken from it and the iterator can be reused for several paths.
 static gchar *
 efactor_get_download_path (struct backend *backend,
 			   struct item_iterator *remote_iter,
 			   const struct fs_operations *ops,
 			   const gchar * dst_dir, const gchar * src_path)
 {
-  gchar *path, *name;
+  gchar *path;
+  gchar **preset;
   struct efactor_data *data = backend->data;
   gchar *src_path_copy = strdup (src_path);
   gint id = atoi (basename (src_path_copy));
   g_free (src_path_copy);
 
-  name = NULL;
-  while (!next_item_iterator (remote_iter))
+  if (!data->preset_table || id < data->min
+      || id - data->min >= data->preset_table->len)
+    {
+      return NULL;
+    }
+
+  preset = g_ptr_array_index (data->preset_table, id - data->min);
+  path = malloc (PATH_MAX);
+  snprintf (path, PATH_MAX, "%s/%s %s.syx", dst_dir,
+	    EFACTOR_PEDAL_NAME (data), preset[EFACTOR_PRESET_NAME_LINE]);
+
+  return path;
+}
+
+//Missing lines are left empty.
+static gchar **
+efactor_new_preset (gchar ** lines)
+{
+  gchar **preset = g_new0 (gchar *, EFACTOR_PRESET_LINES + 1);
+
+  for (gint i = 0; i < EFACTOR_PRESET_LINES; i++)
     {
-      if (remote_iter->item.id == id)
+      preset[i] = g_strdup (*lines ? *lines : "");
+      if (*lines)
 	{
-	  name = get_item_name (&remote_iter->item);
-	  break;
+	  lines++;
 	}
     }
 
-  if (!name)
+  return preset;
+}
+
+static void
+efactor_set_preset (struct efactor_data *data, guint index, gchar ** lines)
+{
+  gchar **preset = efactor_new_preset (lines);
+
+  if (index < data->preset_table->len)
     {
-      return NULL;
+      g_strfreev (data->preset_table->pdata[index]);
+      data->preset_table->pdata[index] = preset;
     }
+  else
+    {
+      g_ptr_array_add (data->preset_table, preset);
+    }
+}
 
-  path = malloc (PATH_MAX);
-  snprintf (path, PATH_MAX, "%s/%s %s.syx", dst_dir,
-	    EFACTOR_PEDAL_NAME (data), name);
+//The message is not trusted to contain a NUL terminated payload.
+static gchar **
+efactor_get_preset_lines (GByteArray * msg)
+{
+  gchar *text, **lines;
 
-  return path;
+  if (msg->len <= EFACTOR_PRESET_DUMP_OFFSET)
+    {
+      return g_new0 (gchar *, 1);
+    }
+
+  text = g_strndup ((gchar *) & msg->data[EFACTOR_PRESET_DUMP_OFFSET],
+		    msg->len - EFACTOR_PRESET_DUMP_OFFSET);
+  lines = g_strsplit (text, EFACTOR_PRESET_LINE_SEPARATOR, -1);
+  g_free (text);
+
+  return lines;
+}
+
+static gint
+efactor_load_preset_table (struct backend *backend)
+{
+  GByteArray *tx_msg, *rx_msg;
+  gchar **lines, **line;
+  struct efactor_data *data = backend->data;
+
+  if (data->read_before)
+    {
+      //Reading from the device switches off and on the internal relays.
+      //In case we call this function again just after calling it, we give the device some time to do it.
+      sleep (1);
+    }
+
+  tx_msg = efactor_new_op_msg (EFACTOR_OP_PRESETS_WANT);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, EFACTOR_RTT_PRESETS,
+					EFACTOR_TIMEOUT_TOTAL_PRESETS);
+  if (!rx_msg)
+    {
+      return -ETIMEDOUT;
+    }
+
+  data->read_before = TRUE;
+
+  lines = efactor_get_preset_lines (rx_msg);
+  free_msg (rx_msg);
+
+  if (g_strv_length (lines) < data->presets * EFACTOR_PRESET_LINES)
+    {
+      error_print ("Incomplete presets dump\n");
+      g_strfreev (lines);
+      return -EIO;
+    }
+
+  data->preset_table =
+    g_ptr_array_new_full (data->presets, (GDestroyNotify) g_strfreev);
+  line = lines;
+  for (guint i = 0; i < data->presets; i++, line += EFACTOR_PRESET_LINES)
+    {
+      efactor_set_preset (data, i, line);
+    }
+  g_strfreev (lines);
+
+  return 0;
+}
+
+static gint
+efactor_refresh (struct backend *backend, const gchar * path)
+{
+  struct efactor_data *data = backend->data;
+
+  debug_print (1, "Invalidating preset table...\n");
+
+  if (data->preset_table)
+    {
+      g_ptr_array_free (data->preset_table, TRUE);
+      data->preset_table = NULL;
+    }
+
+  return 0;
 }
 
 static guint
@@ -154,7 +277,7 @@ efactor_next_dentry (struct item_iterator *iter)
 {
   struct efactor_iter_data *data = iter->data;
   struct efactor_data *backend_data = data->backend_data;
-  gchar *preset_name;
+  gchar **preset;
 
   if (data->next == data->presets)
     {
@@ -162,8 +285,9 @@ efactor_next_dentry (struct item_iterator *iter)
     }
 
   iter->item.id = data->next + backend_data->min;
-  preset_name = data->backend_data->lines[data->next * 7 + 6];
-  snprintf (iter->item.name, LABEL_MAX, "%s", preset_name);
+  preset = g_ptr_array_index (backend_data->preset_table, data->next);
+  snprintf (iter->item.name, LABEL_MAX, "%s",
+	    preset[EFACTOR_PRESET_NAME_LINE]);
   iter->item.type = ELEKTROID_FILE;
   iter->item.size = -1;
   data->next++;
@@ -175,8 +299,7 @@ static gint
 efactor_read_dir (struct backend *backend, struct item_iterator *iter,
 		  const gchar * path)
 {
-  GByteArray *tx_msg;
-  GByteArray *rx_msg;
+  gint err;
   struct efactor_iter_data *iter_data;
   struct efactor_data *data = backend->data;
 
@@ -185,33 +308,19 @@ efactor_read_dir (struct backend *backend, struct item_iterator *iter,
       return -ENOTDIR;
     }
 
-  if (data->lines)
-    {
-      //Reading from the device switches off and on the internal relays.
-      //In case we call this function again just after calling it, we give the device some time to do it.
-      sleep (1);
-    }
-
-  tx_msg = efactor_new_op_msg (EFACTOR_OP_PRESETS_WANT);
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg,
-				    EFACTOR_TIMEOUT_TOTAL_PRESETS);
-  if (!rx_msg)
+  if (!data->preset_table)
     {
-      return -ETIMEDOUT;
+      err = efactor_load_preset_table (backend);
+      if (err)
+	{
+	  return err;
+	}
     }
 
   iter_data = g_malloc (sizeof (struct efactor_iter_data));
   iter_data->next = 0;
   iter_data->presets = data->presets;
   iter_data->backend_data = backend->data;
-  if (iter_data->backend_data->lines)
-    {
-      g_strfreev (iter_data->backend_data->lines);
-    }
-  data->lines =
-    g_strsplit ((gchar *) & rx_msg->data[EFACTOR_PRESET_DUMP_OFFSET],
-		EFACTOR_PRESET_LINE_SEPARATOR, -1);
-  free_msg (rx_msg);
   iter->data = iter_data;
   iter->next = efactor_next_dentry;
   iter->free = g_free;
@@ -219,6 +328,21 @@ efactor_read_dir (struct backend *backend, struct item_iterator *iter,
   return 0;
 }
 
+static void
+efactor_append_preset (GByteArray * output, gchar ** lines)
+{
+  g_byte_array_append (output, EFACTOR_REQUEST_HEADER,
+		       sizeof (EFACTOR_REQUEST_HEADER));
+  g_byte_array_append (output, (guint8 *) "\x49", 1);	// EFACTOR_OP_PRESETS_DUMP
+  for (gint i = 0; i < EFACTOR_PRESET_LINES; i++, lines++)
+    {
+      g_byte_array_append (output, (guint8 *) * lines, strlen (*lines));
+      g_byte_array_append (output, (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
+			   strlen (EFACTOR_PRESET_LINE_SEPARATOR));
+    }
+  g_byte_array_append (output, (guint8 *) "\0\xf7", 2);
+}
+
 static gint
 efactor_download (struct backend *backend, const gchar * src_path,
 		  GByteArray * output, struct job_control *control)
@@ -226,39 +350,31 @@ efactor_download (struct backend *backend, const gchar * src_path,
   gint err = 0, id;
   gchar *basename_copy;
   gboolean active;
-  gchar **lines;
   struct efactor_data *data = backend->data;
 
   control->parts = 1;
   control->part = 0;
   set_job_control_progress (control, 0.0);
 
-  if (!data->lines)
+  if (!data->preset_table)
     {
-      struct item_iterator iter;
-      err = efactor_read_dir (backend, &iter, "/");
+      err = efactor_load_preset_table (backend);
       if (err)
 	{
 	  return err;
 	}
-      free_item_iterator (&iter);
     }
 
   basename_copy = strdup (src_path);
   id = atoi (basename (basename_copy)) - data->min;	//Base 0
   g_free (basename_copy);
 
-  g_byte_array_append (output, EFACTOR_REQUEST_HEADER,
-		       sizeof (EFACTOR_REQUEST_HEADER));
-  g_byte_array_append (output, (guint8 *) "\x49", 1);	// EFACTOR_OP_PRESETS_DUMP
-  lines = &data->lines[id * 7];
-  for (gint i = 0; i < 7; i++, lines++)
+  if (id < 0 || id >= data->preset_table->len)
     {
-      g_byte_array_append (output, (guint8 *) * lines, strlen (*lines));
-      g_byte_array_append (output, (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
-			   strlen (EFACTOR_PRESET_LINE_SEPARATOR));
+      return -EINVAL;
     }
-  g_byte_array_append (output, (guint8 *) "\0\xf7", 2);
+
+  efactor_append_preset (output, g_ptr_array_index (data->preset_table, id));
 
   g_mutex_lock (&control->mutex);
   active = control->active;
@@ -277,12 +393,11 @@ efactor_download (struct backend *backend, const gchar * src_path,
 }
 
 static gint
-efactor_upload (struct backend *backend, const gchar * path,
-		GByteArray * input, struct job_control *control)
+efactor_get_upload_msg (struct backend *backend, const gchar * path,
+			GByteArray * input, GByteArray ** msg)
 {
-  gint err = 0, i, id;
+  gint i, id;
   gchar *name, *b;
-  gboolean active;
   GByteArray *tx_msg;
   gchar id_tag[EFACTOR_MAX_ID_TAG_LEN];
   struct efactor_data *data = backend->data;
@@ -291,10 +406,6 @@ efactor_upload (struct backend *backend, const gchar * path,
   id = atoi (basename (name));	//This stops at the ':'.
   g_free (name);
 
-  control->parts = 1;
-  control->part = 0;
-  set_job_control_progress (control, 0.0);
-
   //The fourth header byte is the device number ID so it might be different than 0.
   input->data[sizeof (EFACTOR_REQUEST_HEADER) - 1] = 0;
   if (input->len > EFACTOR_SINGLE_PRESET_MAX_LEN
@@ -305,8 +416,7 @@ efactor_upload (struct backend *backend, const gchar * path,
       EFACTOR_OP_PRESETS_DUMP)
     {
       error_print ("Bad preset\n");
-      err = -EBADMSG;
-      goto end;
+      return -EBADMSG;
     }
 
   tx_msg = g_byte_array_sized_new (input->len + 2);	// With this we ensure there is enough space for all the digits of the preset number.
@@ -328,12 +438,62 @@ efactor_upload (struct backend *backend, const gchar * path,
   if (i == input->len)
     {
       free_msg (tx_msg);
-      err = -EBADMSG;
-      goto end;
+      return -EBADMSG;
     }
   g_byte_array_append (tx_msg, (guint8 *) b, input->len - i);
 
+  *msg = tx_msg;
+
+  return 0;
+}
+
+//Only called after the preset has been sent.
+static void
+efactor_update_preset_table (struct backend *backend, const gchar * path,
+			     gchar ** lines)
+{
+  gint id;
+  gchar *name;
+  struct efactor_data *data = backend->data;
+
+  name = strdup (path);
+  id = atoi (basename (name));	//This stops at the ':'.
+  g_free (name);
+
+  if (data->preset_table && id >= data->min
+      && id - data->min < data->preset_table->len)
+    {
+      efactor_set_preset (data, id - data->min, lines);
+    }
+}
+
+static gint
+efactor_upload (struct backend *backend, const gchar * path,
+		GByteArray * input, struct job_control *control)
+{
+  gint err;
+  gboolean active;
+  gchar **lines;
+  GByteArray *tx_msg;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  err = efactor_get_upload_msg (backend, path, input, &tx_msg);
+  if (err)
+    {
+      return err;
+    }
+
+  //backend_tx frees the message.
+  lines = efactor_get_preset_lines (tx_msg);
   err = backend_tx (backend, tx_msg);
+  if (!err)
+    {
+      efactor_update_preset_table (backend, path, lines);
+    }
+  g_strfreev (lines);
 
   g_mutex_lock (&control->mutex);
   active = control->active;
@@ -348,18 +508,47 @@ efactor_upload (struct backend *backend, const gchar * path,
       err = -ECANCELED;
     }
 
-end:
   return err;
 }
 
+//Used in ranges. The preset is only queued as all of them are sent together at the end.
+static gint
+efactor_upload_queue (struct backend *backend, const gchar * path,
+		      GByteArray * input, struct job_control *control)
+{
+  gint err;
+  gchar **lines;
+  GByteArray *tx_msg;
+  struct efactor_data *data = backend->data;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  err = efactor_get_upload_msg (backend, path, input, &tx_msg);
+  if (err)
+    {
+      return err;
+    }
+
+  lines = efactor_get_preset_lines (tx_msg);
+  g_ptr_array_add (data->pending, efactor_new_preset (lines));
+  g_strfreev (lines);
+  free_msg (tx_msg);
+
+  set_job_control_progress (control, 1.0);
+
+  return 0;
+}
+
 static gint
 efactor_rename (struct backend *backend, const gchar * src, const gchar * dst)
 {
-  GByteArray *preset, *rx_msg;
+  struct sysex_transfer transfer;
   guint id;
   gint err;
-  struct job_control control;
-  gchar **lines, **line;
+  gchar **lines;
+  struct efactor_data *data = backend->data;
   debug_print (1, "Sending rename request...\n");
   err = common_slot_get_id_name_from_path (src, &id, NULL);
   if (err)
@@ -367,35 +556,353 @@ efactor_rename (struct backend *backend, const gchar * src, const gchar * dst)
       return err;
     }
 
-  preset = g_byte_array_new ();
-  efactor_download (backend, src, preset, &control);
+  if (!data->preset_table)
+    {
+      err = efactor_load_preset_table (backend);
+      if (err)
+	{
+	  return err;
+	}
+    }
+
+  if (id < data->min || id - data->min >= data->preset_table->len)
+    {
+      return -EINVAL;
+    }
 
-  lines = g_strsplit ((gchar *) & preset->data[EFACTOR_PRESET_DUMP_OFFSET],
-		      EFACTOR_PRESET_LINE_SEPARATOR, -1);
-  g_free (lines[6]);
-  lines[6] = NULL;
+  //A renamed copy of the preset in the table is sent and then stored.
+  lines = efactor_new_preset (g_ptr_array_index (data->preset_table,
+						 id - data->min));
+  g_free (lines[EFACTOR_PRESET_NAME_LINE]);
+  lines[EFACTOR_PRESET_NAME_LINE] = g_strdup (dst);
 
-  line = lines;
-  g_byte_array_set_size (preset, EFACTOR_PRESET_DUMP_OFFSET);
-  while (*line)
+  transfer.raw = g_byte_array_new ();
+  efactor_append_preset (transfer.raw, lines);
+  transfer.timeout = 100;
+
+  //There must be no response so only a timeout means success.
+  backend_tx_and_rx_sysex_transfer (backend, &transfer, TRUE);
+  if (!transfer.err)
     {
-      g_byte_array_append (preset, (guint8 *) (*line), strlen (*line));
-      g_byte_array_append (preset, (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
-			   strlen (EFACTOR_PRESET_LINE_SEPARATOR));
-      line++;
+      err = -EIO;
+      free_msg (transfer.raw);
+    }
+  else if (transfer.err == -ETIMEDOUT)
+    {
+      efactor_set_preset (data, id - data->min, lines);
+    }
+  else
+    {
+      err = transfer.err;
     }
-  g_byte_array_append (preset, (guint8 *) dst, strlen (dst));
-  g_byte_array_append (preset, (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
-		       strlen (EFACTOR_PRESET_LINE_SEPARATOR));
-  g_byte_array_append (preset, (guint8 *) "\0\xf7", 2);
   g_strfreev (lines);
 
-  rx_msg = backend_tx_and_rx_sysex (backend, preset, 100);	//There must be no response.
-  if (rx_msg)
+  return err;
+}
+
+static guint
+efactor_bank_next_dentry (struct item_iterator *iter)
+{
+  guint *next = iter->data;
+
+  if (*next)
     {
-      err = -EIO;
-      free_msg (rx_msg);
+      return -ENOENT;
     }
+
+  iter->item.id = 0;
+  snprintf (iter->item.name, LABEL_MAX, "%s", EFACTOR_BANK_NAME);
+  iter->item.type = ELEKTROID_FILE;
+  iter->item.size = -1;
+  (*next)++;
+
+  return 0;
+}
+
+static gint
+efactor_bank_read_dir (struct backend *backend, struct item_iterator *iter,
+		       const gchar * path)
+{
+  if (strcmp (path, "/"))
+    {
+      return -ENOTDIR;
+    }
+
+  iter->data = g_malloc0 (sizeof (guint));
+  iter->next = efactor_bank_next_dentry;
+  iter->free = g_free;
+
+  return 0;
+}
+
+//The bank is the same message the device sends when all the presets are requested.
+static gint
+efactor_bank_download (struct backend *backend, const gchar * src_path,
+		       GByteArray * output, struct job_control *control)
+{
+  gint err;
+  gchar **lines;
+  gboolean active;
+  struct efactor_data *data = backend->data;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  if (!data->preset_table)
+    {
+      err = efactor_load_preset_table (backend);
+      if (err)
+	{
+	  return err;
+	}
+    }
+
+  g_byte_array_append (output, EFACTOR_REQUEST_HEADER,
+		       sizeof (EFACTOR_REQUEST_HEADER));
+  g_byte_array_append (output, (guint8 *) "\x49", 1);	// EFACTOR_OP_PRESETS_DUMP
+  for (guint i = 0; i < data->preset_table->len; i++)
+    {
+      lines = g_ptr_array_index (data->preset_table, i);
+      for (gint j = 0; j < EFACTOR_PRESET_LINES; j++)
+	{
+	  g_byte_array_append (output, (guint8 *) lines[j], strlen (lines[j]));
+	  g_byte_array_append (output,
+			       (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
+			       strlen (EFACTOR_PRESET_LINE_SEPARATOR));
+	}
+    }
+  g_byte_array_append (output, (guint8 *) "\0\xf7", 2);
+
+  g_mutex_lock (&control->mutex);
+  active = control->active;
+  g_mutex_unlock (&control->mutex);
+
+  if (active)
+    {
+      set_job_control_progress (control, 1.0);
+      return 0;
+    }
+  else
+    {
+      return -ECANCELED;
+    }
+}
+
+//Every preset is identified by the tag at the beginning of its first line.
+static gint
+efactor_get_preset_index (struct efactor_data *data, const gchar * line)
+{
+  gchar **preset;
+  const gchar *tag_end = strchr (line, ']');
+
+  if (*line != '[' || !tag_end)
+    {
+      return -1;
+    }
+
+  for (guint i = 0; i < data->preset_table->len; i++)
+    {
+      preset = g_ptr_array_index (data->preset_table, i);
+      if (!strncmp (preset[0], line, tag_end - line + 1))
+	{
+	  return i;
+	}
+    }
+
+  return -1;
+}
+
+//The input might be a bank or any amount of concatenated presets or banks.
+static GPtrArray *
+efactor_bank_get_presets (GByteArray * input)
+{
+  gchar **lines, **line;
+  guint8 *msg, *end;
+  GPtrArray *presets =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_strfreev);
+
+  msg = input->data;
+  end = input->data + input->len;
+  while (msg < end)
+    {
+      guint8 *msg_end = memchr (msg, 0xf7, end - msg);
+      if (!msg_end)
+	{
+	  break;
+	}
+
+      if (msg_end - msg > EFACTOR_PRESET_DUMP_OFFSET
+	  && !memcmp (msg, EFACTOR_REQUEST_HEADER,
+		      sizeof (EFACTOR_REQUEST_HEADER) - 1)
+	  && msg[sizeof (EFACTOR_REQUEST_HEADER)] == EFACTOR_OP_PRESETS_DUMP)
+	{
+	  gchar *text = g_strndup ((gchar *) & msg[EFACTOR_PRESET_DUMP_OFFSET],
+				   msg_end - msg - EFACTOR_PRESET_DUMP_OFFSET);
+	  lines = g_strsplit (text, EFACTOR_PRESET_LINE_SEPARATOR, -1);
+	  g_free (text);
+
+	  for (line = lines; g_strv_length (line) >= EFACTOR_PRESET_LINES;
+	       line += EFACTOR_PRESET_LINES)
+	    {
+	      if (**line != '[')
+		{
+		  break;
+		}
+	      g_ptr_array_add (presets, efactor_new_preset (line));
+	    }
+	  g_strfreev (lines);
+	}
+
+      msg = msg_end + 1;
+    }
+
+  return presets;
+}
+
+static GByteArray *
+efactor_get_presets_msg (struct efactor_data *data, GPtrArray * presets)
+{
+  gchar **preset;
+  GByteArray *tx_msg = g_byte_array_new ();
+
+  g_byte_array_append (tx_msg, EFACTOR_REQUEST_HEADER,
+		       sizeof (EFACTOR_REQUEST_HEADER));
+  tx_msg->data[sizeof (EFACTOR_REQUEST_HEADER) - 1] = (guint8) data->id;
+  g_byte_array_append (tx_msg, (guint8 *) "\x49", 1);	// EFACTOR_OP_PRESETS_DUMP
+  for (guint i = 0; i < presets->len; i++)
+    {
+      preset = g_ptr_array_index (presets, i);
+      for (gint j = 0; j < EFACTOR_PRESET_LINES; j++)
+	{
+	  g_byte_array_append (tx_msg, (guint8 *) preset[j],
+			       strlen (preset[j]));
+	  g_byte_array_append (tx_msg,
+			       (guint8 *) EFACTOR_PRESET_LINE_SEPARATOR,
+			       strlen (EFACTOR_PRESET_LINE_SEPARATOR));
+	}
+    }
+  g_byte_array_append (tx_msg, (guint8 *) "\0\xf7", 2);
+
+  return tx_msg;
+}
+
+//The presets are sent in a single message and then read back and compared with the sent ones.
+static gint
+efactor_send_presets (struct backend *backend, GPtrArray * presets)
+{
+  gint err, index;
+  gchar **preset, **stored;
+  struct efactor_data *data = backend->data;
+
+  debug_print (1, "Sending %d presets in a single message...\n",
+	       presets->len);
+
+  err = backend_tx (backend, efactor_get_presets_msg (data, presets));
+  if (err)
+    {
+      return err;
+    }
+
+  efactor_refresh (backend, NULL);
+  err = efactor_load_preset_table (backend);
+  if (err)
+    {
+      return err;
+    }
+
+  for (guint i = 0; i < presets->len; i++)
+    {
+      preset = g_ptr_array_index (presets, i);
+      index = efactor_get_preset_index (data, preset[0]);
+      if (index < 0)
+	{
+	  error_print ("Preset %s not found in the device\n", preset[0]);
+	  return -EIO;
+	}
+      stored = g_ptr_array_index (data->preset_table, index);
+      for (gint j = 0; j < EFACTOR_PRESET_LINES; j++)
+	{
+	  if (strcmp (stored[j], preset[j]))
+	    {
+	      error_print ("Preset '%s' differs from the sent one\n",
+			   stored[EFACTOR_PRESET_NAME_LINE]);
+	      return -EIO;
+	    }
+	}
+    }
+
+  debug_print (1, "%d presets verified\n", presets->len);
+
+  return 0;
+}
+
+static gint
+efactor_bank_upload (struct backend *backend, const gchar * path,
+		     GByteArray * input, struct job_control *control)
+{
+  gint err = 0;
+  gboolean active;
+  GPtrArray *presets;
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  presets = efactor_bank_get_presets (input);
+  if (!presets->len)
+    {
+      error_print ("No presets found\n");
+      err = -EBADMSG;
+      goto end;
+    }
+
+  err = efactor_send_presets (backend, presets);
+  if (err)
+    {
+      goto end;
+    }
+
+  g_mutex_lock (&control->mutex);
+  active = control->active;
+  g_mutex_unlock (&control->mutex);
+
+  if (active)
+    {
+      set_job_control_progress (control, 1.0);
+    }
+  else
+    {
+      err = -ECANCELED;
+    }
+
+end:
+  g_ptr_array_free (presets, TRUE);
+  return err;
+}
+
+//All the presets in a range are sent in a single message, as in the bank filesystem.
+static gint
+efactor_upload_range (struct backend *backend, GPtrArray * paths,
+		      fs_range_item_func item, struct job_control *control,
+		      void *cb_data)
+{
+  gint err;
+  struct efactor_data *data = backend->data;
+
+  data->pending =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) g_strfreev);
+
+  err = backend_run_range (backend, paths, efactor_upload_queue, TRUE, item,
+			   control, cb_data);
+  if (!err && data->pending->len)
+    {
+      err = efactor_send_presets (backend, data->pending);
+    }
+
+  g_ptr_array_free (data->pending, TRUE);
+  data->pending = NULL;
+
   return err;
 }
 
@@ -436,8 +943,10 @@ static const struct fs_operations FS_EFACTOR_OPERATIONS = {
   .readdir = efactor_read_dir,
   .print_item = efactor_print,
   .rename = efactor_rename,
+  .refresh = efactor_refresh,
   .download = efactor_download,
   .upload = efactor_upload,
+  .upload_range = efactor_upload_range,
   .get_id = get_item_index,
   .get_slot = efactor_get_slot,
   .load = load_file,
@@ -447,18 +956,40 @@ static const struct fs_operations FS_EFACTOR_OPERATIONS = {
   .get_download_path = efactor_get_download_path
 };
 
-static const struct fs_operations *FS_EFACTOR_OPERATIONS_LIST[] = {
-  &FS_EFACTOR_OPERATIONS, NULL
+static void
+efactor_bank_print (struct item_iterator *iter, struct backend *backend)
+{
+  printf ("%c %s\n", iter->item.type, iter->item.name);
+}
+
+static const struct fs_operations FS_EFACTOR_BANK_OPERATIONS = {
+  .fs = FS_EFACTOR_BANK,
+  .options = FS_OPTION_SINGLE_OP | FS_OPTION_SLOT_STORAGE,
+  .name = "bank",
+  .gui_name = "Banks",
+  .gui_icon = BE_FILE_ICON_SND,
+  .type_ext = "syx",
+  .readdir = efactor_bank_read_dir,
+  .print_item = efactor_bank_print,
+  .refresh = efactor_refresh,
+  .download = efactor_bank_download,
+  .upload = efactor_bank_upload,
+  .get_id = get_item_index,
+  .load = load_file,
+  .save = save_file,
+  .get_ext = backend_get_fs_ext,
+  .get_upload_path = common_slot_get_upload_path,
+  .get_download_path = efactor_get_download_path
+};
+
+const struct fs_operations *FS_EFACTOR_OPERATIONS_LIST[] = {
+  &FS_EFACTOR_OPERATIONS, &FS_EFACTOR_BANK_OPERATIONS, NULL
 };
 
 void
 efactor_destroy_data (struct backend *backend)
 {
-  struct efactor_data *data = backend->data;
-  if (data->lines)
-    {
-      g_strfreev (data->lines);
-    }
+  efactor_refresh (backend, NULL);
   backend_destroy_data (backend);
 }
 
@@ -534,25 +1065,45 @@ efactor_handshake (struct backend *backend)
     }
 
   tx_msg = efactor_new_get_msg (EFACTOR_MSG_TYPE_OBJECT, "0000");	//tj_version_key
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, EFACTOR_RTT_GET,
+					backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
   id = rx_msg->data[sizeof (EFACTOR_REQUEST_HEADER) - 1];
   debug_print (1, "Version: %s\n", &rx_msg->data[7]);
   free_msg (rx_msg);
 
   tx_msg = efactor_new_get_msg (EFACTOR_MSG_TYPE_VALUE, "0001");	//tj_switch_key
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, EFACTOR_RTT_GET,
+					backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
   debug_print (1, "Switches: %s\n", &rx_msg->data[7]);
   swlen = strlen ((gchar *) & rx_msg->data[7]) - 2;	//Remove single quotes
   free_msg (rx_msg);
 
   tx_msg = efactor_new_get_msg (EFACTOR_MSG_TYPE_OBJECT, "0206");	//sp_num_banks_lo
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, EFACTOR_RTT_GET,
+					backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
   debug_print (1, "Minimum value: %s\n", &rx_msg->data[7]);
   min = atoi ((gchar *) & rx_msg->data[9]);
   free_msg (rx_msg);
 
   tx_msg = efactor_new_get_msg (EFACTOR_MSG_TYPE_OBJECT, "020A");	//sp_num_banks
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg, EFACTOR_RTT_GET,
+					backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
   debug_print (1, "Maximum value: %s\n", &rx_msg->data[7]);
   max = atoi ((gchar *) & rx_msg->data[9]);
   free_msg (rx_msg);
@@ -583,9 +1134,11 @@ efactor_handshake (struct backend *backend)
   data->presets = presets;
   data->min = min;
   data->type = type;
-  data->lines = NULL;
+  data->preset_table = NULL;
+  data->read_before = FALSE;
+  data->pending = NULL;
 
-  backend->device_desc.filesystems = FS_EFACTOR_PRESET;
+  backend->device_desc.filesystems = FS_EFACTOR_PRESET | FS_EFACTOR_BANK;
   backend->fs_ops = FS_EFACTOR_OPERATIONS_LIST;
   backend->destroy_data = efactor_destroy_data;
   backend->data = data;
@@ -595,5 +1148,7 @@ efactor_handshake (struct backend *backend)
 	    backend->midi_info.version[1], backend->midi_info.version[2],
 	    backend->midi_info.version[3]);
 
+  backend_load_profile (backend, EFACTOR_PEDAL_NAME (data));
+
   return 0;
 }
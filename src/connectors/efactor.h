@@ -23,6 +23,8 @@
 
 #include "backend.h"
 
+extern const struct fs_operations *FS_EFACTOR_OPERATIONS_LIST[];
+
 gint efactor_handshake (struct backend *);
 
 #endif
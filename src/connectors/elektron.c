@@ -38,10 +38,12 @@
 #define DEV_TAG_ALIAS "alias"
 #define DEV_TAG_FILESYSTEMS "filesystems"
 #define DEV_TAG_STORAGE "storage"
+#define DEV_TAG_PROFILE "profile"
 
 static const gchar *FS_TYPE_NAMES[] = { "+Drive", "RAM" };
 
-#define DATA_TRANSF_BLOCK_BYTES 0x2000
+#define DATA_TRANSF_BLOCK_BYTES 0x2000	//Default and maximum
+#define DATA_TRANSF_BLOCK_BYTES_MIN 0x200
 #define OS_TRANSF_BLOCK_BYTES 0x800
 #define MAX_ZIP_SIZE (128 * 1024 * 1024)
 
@@ -93,6 +95,17 @@ struct elektron_data
   gchar fw_version[LABEL_MAX];
 };
 
+struct elektron_os_image
+{
+  const guint8 *data;
+  guint len;
+  guint blocks;
+  guint32 *crcs;
+  guint ready;
+  GMutex mutex;
+  GCond cond;
+};
+
 typedef GByteArray *(*elektron_msg_id_func) (guint);
 
 typedef GByteArray *(*elektron_msg_id_len_func) (guint, guint);
@@ -104,7 +117,8 @@ typedef GByteArray *(*elektron_msg_path_len_func) (const gchar *, guint);
 typedef GByteArray *(*elektron_msg_read_blk_func) (guint, guint, guint);
 
 typedef GByteArray *(*elektron_msg_write_blk_func) (guint, GByteArray *,
-						    guint *, guint, void *);
+						    guint *, guint, guint,
+						    void *);
 
 typedef void (*elektron_copy_array) (GByteArray *, GByteArray *);
 
@@ -218,7 +232,8 @@ static gchar *elektron_get_download_name (struct backend *,
 					  const struct fs_operations *,
 					  const gchar *);
 
-static gint elektron_upgrade_os (struct backend *, struct sysex_transfer *);
+static gint elektron_upgrade_os (struct backend *, const gchar *,
+				 struct sysex_transfer *);
 
 static gint elektron_sample_load (const gchar *, GByteArray *,
 				  struct job_control *);
@@ -351,8 +366,8 @@ static const struct fs_operations FS_RAW_PRESETS_OPERATIONS = {
   .download = elektron_download_raw_pst_pkg,
   .upload = elektron_upload_raw_pst_pkg,
   .get_id = get_item_name,
-  .load = load_file,
-  .save = save_file,
+  .load = package_load,
+  .save = package_save,
   .get_ext = elektron_get_dev_and_fs_ext,
   .get_upload_path = elektron_get_upload_path_smplrw,
   .get_download_path = elektron_get_download_path
@@ -397,8 +412,8 @@ static const struct fs_operations FS_DATA_PRJ_OPERATIONS = {
   .download = elektron_download_data_prj_pkg,
   .upload = elektron_upload_data_prj_pkg,
   .get_id = get_item_index,
-  .load = load_file,
-  .save = save_file,
+  .load = package_load,
+  .save = package_save,
   .get_ext = elektron_get_dev_and_fs_ext,
   .get_upload_path = elektron_get_upload_path_data,
   .get_download_path = elektron_get_download_path
@@ -421,14 +436,14 @@ static const struct fs_operations FS_DATA_SND_OPERATIONS = {
   .download = elektron_download_data_snd_pkg,
   .upload = elektron_upload_data_snd_pkg,
   .get_id = get_item_index,
-  .load = load_file,
-  .save = save_file,
+  .load = package_load,
+  .save = package_save,
   .get_ext = elektron_get_dev_and_fs_ext,
   .get_upload_path = elektron_get_upload_path_data,
   .get_download_path = elektron_get_download_path
 };
 
-static const struct fs_operations *FS_OPERATIONS[] = {
+const struct fs_operations *FS_ELEKTRON_OPERATIONS[] = {
   &FS_SAMPLES_OPERATIONS, &FS_RAW_ANY_OPERATIONS, &FS_RAW_PRESETS_OPERATIONS,
   &FS_DATA_ANY_OPERATIONS, &FS_DATA_PRJ_OPERATIONS, &FS_DATA_SND_OPERATIONS,
   NULL
@@ -803,9 +818,23 @@ elektron_new_msg_list (const gchar * path, int32_t start_index,
   return msg;
 }
 
+//The block length must be even as samples are written in 16 bits words.
+
+static guint
+elektron_get_block_len (struct backend *backend)
+{
+  if (!backend->profile.block_len)
+    {
+      return DATA_TRANSF_BLOCK_BYTES;
+    }
+  return CLAMP (backend->profile.block_len & ~1, DATA_TRANSF_BLOCK_BYTES_MIN,
+		DATA_TRANSF_BLOCK_BYTES);
+}
+
 static GByteArray *
 elektron_new_msg_write_sample_blk (guint id, GByteArray * sample,
-				   guint * total, guint seq, void *data)
+				   guint * total, guint seq, guint blk_len,
+				   void *data)
 {
   guint32 aux32;
   guint16 aux16, *aux16p;
@@ -818,10 +847,10 @@ elektron_new_msg_write_sample_blk (guint id, GByteArray * sample,
 
   aux32 = htobe32 (id);
   memcpy (&msg->data[5], &aux32, sizeof (guint32));
-  aux32 = htobe32 (DATA_TRANSF_BLOCK_BYTES * seq);
+  aux32 = htobe32 (blk_len * seq);
   memcpy (&msg->data[13], &aux32, sizeof (guint32));
 
-  bytes_blk = DATA_TRANSF_BLOCK_BYTES;
+  bytes_blk = blk_len;
   consumed = 0;
 
   if (seq == 0)
@@ -862,7 +891,7 @@ elektron_new_msg_write_sample_blk (guint id, GByteArray * sample,
 
 static GByteArray *
 elektron_new_msg_write_raw_blk (guint id, GByteArray * raw, guint * total,
-				guint seq, void *data)
+				guint seq, guint blk_len, void *data)
 {
   gint len;
   guint32 aux32;
@@ -871,11 +900,11 @@ elektron_new_msg_write_raw_blk (guint id, GByteArray * raw, guint * total,
 
   aux32 = htobe32 (id);
   memcpy (&msg->data[5], &aux32, sizeof (guint32));
-  aux32 = htobe32 (DATA_TRANSF_BLOCK_BYTES * seq);
+  aux32 = htobe32 (blk_len * seq);
   memcpy (&msg->data[13], &aux32, sizeof (guint32));
 
   len = raw->len - *total;
-  len = len > DATA_TRANSF_BLOCK_BYTES ? DATA_TRANSF_BLOCK_BYTES : len;
+  len = len > blk_len ? blk_len : len;
   g_byte_array_append (msg, &raw->data[*total], len);
   (*total) += len;
 
@@ -1067,7 +1096,8 @@ elektron_tx_and_rx_timeout_no_cache (struct backend *backend,
       goto cleanup;
     }
 
-  rx_msg = elektron_rx (backend, timeout < 0 ? BE_SYSEX_TIMEOUT_MS : timeout);
+  rx_msg = elektron_rx (backend,
+			timeout < 0 ? backend->profile.timeout : timeout);
   if (rx_msg && rx_msg->data[4] != msg_type)
     {
       error_print ("Illegal message type in response\n");
@@ -1574,7 +1604,9 @@ elektron_upload_smplrw (struct backend *backend, const gchar * path,
 
   while (transferred < input->len && active)
     {
-      tx_msg = new_msg_write_blk (id, input, &transferred, i, control->data);
+      tx_msg = new_msg_write_blk (id, input, &transferred, i,
+				  elektron_get_block_len (backend),
+				  control->data);
       rx_msg = elektron_tx_and_rx (backend, tx_msg);
       if (!rx_msg)
 	{
@@ -1593,7 +1625,7 @@ elektron_upload_smplrw (struct backend *backend, const gchar * path,
       active = control->active;
       g_mutex_unlock (&control->mutex);
 
-      usleep (BE_REST_TIME_US);
+      usleep (backend->profile.rest_time);
     }
 
   debug_print (2, "%d bytes sent\n", transferred);
@@ -1739,10 +1771,8 @@ elektron_download_smplrw (struct backend *backend, const gchar * path,
   control->data = NULL;
   while (next_block_start < frames && active)
     {
-      req_size =
-	frames - next_block_start >
-	DATA_TRANSF_BLOCK_BYTES ? DATA_TRANSF_BLOCK_BYTES : frames -
-	next_block_start;
+      req_size = MIN (frames - next_block_start,
+		      elektron_get_block_len (backend));
       tx_msg = new_msg_read_blk (id, next_block_start, req_size);
       rx_msg = elektron_tx_and_rx (backend, tx_msg);
       if (!rx_msg)
@@ -1781,7 +1811,7 @@ elektron_download_smplrw (struct backend *backend, const gchar * path,
       active = control->active;
       g_mutex_unlock (&control->mutex);
 
-      usleep (BE_REST_TIME_US);
+      usleep (backend->profile.rest_time);
     }
 
   debug_print (2, "%d bytes received\n", next_block_start);
@@ -1863,89 +1893,187 @@ elektron_new_msg_upgrade_os_start (guint size)
 }
 
 static GByteArray *
-elektron_new_msg_upgrade_os_write (GByteArray * os_data, gint * offset)
+elektron_new_msg_upgrade_os_write (const guint8 * os_data, guint len,
+				   guint offset, guint32 crc)
 {
   GByteArray *msg = elektron_new_msg (OS_UPGRADE_WRITE_RESPONSE,
 				      sizeof (OS_UPGRADE_WRITE_RESPONSE));
-  guint len;
-  guint32 crc;
   guint32 aux32;
 
-  if (*offset + OS_TRANSF_BLOCK_BYTES < os_data->len)
-    {
-      len = OS_TRANSF_BLOCK_BYTES;
-    }
-  else
-    {
-      len = os_data->len - *offset;
-    }
-
-  crc = crc32 (0xffffffff, &os_data->data[*offset], len);
-
   debug_print (2, "CRC: %0x\n", crc);
 
   aux32 = htobe32 (crc);
   memcpy (&msg->data[5], &aux32, sizeof (guint32));
   aux32 = htobe32 (len);
   memcpy (&msg->data[9], &aux32, sizeof (guint32));
-  aux32 = htobe32 (*offset);
+  aux32 = htobe32 (offset);
   memcpy (&msg->data[13], &aux32, sizeof (guint32));
 
-  g_byte_array_append (msg, &os_data->data[*offset], len);
-
-  *offset = *offset + len;
+  g_byte_array_append (msg, &os_data[offset], len);
 
   return msg;
 }
 
-static gint
-elektron_upgrade_os (struct backend *backend, struct sysex_transfer *transfer)
+static guint
+elektron_get_os_block_len (struct elektron_os_image *image, guint block)
 {
-  GByteArray *tx_msg;
-  GByteArray *rx_msg;
-  gint8 op;
-  gint offset;
-  gint res = 0;
+  guint offset = block * OS_TRANSF_BLOCK_BYTES;
+  return MIN (OS_TRANSF_BLOCK_BYTES, image->len - offset);
+}
 
-  tx_msg = elektron_new_msg_upgrade_os_start (transfer->raw->len);
-  rx_msg = elektron_tx_and_rx (backend, tx_msg);
+//The CRCs of all the blocks are computed ahead by this thread while the
+//first blocks are already being sent.
 
-  if (!rx_msg)
+static gpointer
+elektron_os_crc_thread (gpointer data)
+{
+  struct elektron_os_image *image = data;
+  guint32 crc;
+  guint len;
+
+  for (guint i = 0; i < image->blocks; i++)
     {
-      res = -EIO;
-      goto end;
+      len = elektron_get_os_block_len (image, i);
+      crc = crc32 (0xffffffff, &image->data[i * OS_TRANSF_BLOCK_BYTES], len);
+
+      g_mutex_lock (&image->mutex);
+      image->crcs[i] = crc;
+      image->ready = i + 1;
+      g_cond_signal (&image->cond);
+      g_mutex_unlock (&image->mutex);
     }
-  //Response: x, x, x, x, 0xd0, [0 (ok), 1 (error)]...
-  op = elektron_get_msg_status (rx_msg);
-  if (op)
+
+  return NULL;
+}
+
+static guint32
+elektron_get_os_block_crc (struct elektron_os_image *image, guint block)
+{
+  guint32 crc;
+
+  g_mutex_lock (&image->mutex);
+  while (image->ready <= block)
     {
-      res = -EIO;
-      error_print ("%s (%s)\n", snd_strerror (res),
-		   elektron_get_msg_string (rx_msg));
-      free_msg (rx_msg);
-      goto end;
+      g_cond_wait (&image->cond, &image->mutex);
     }
+  crc = image->crcs[block];
+  g_mutex_unlock (&image->mutex);
 
-  free_msg (rx_msg);
+  return crc;
+}
 
-  offset = 0;
-  while (offset < transfer->raw->len)
+static gint os_upgrade_window = OS_UPGRADE_WINDOW_DEFAULT;
+
+void
+elektron_set_os_upgrade_window (gint window)
+{
+  if (window < 1 || window > OS_UPGRADE_WINDOW_MAX)
     {
-      tx_msg = elektron_new_msg_upgrade_os_write (transfer->raw, &offset);
-      rx_msg = elektron_tx_and_rx (backend, tx_msg);
+      error_print ("Invalid OS upgrade window %d. Using default...\n",
+		   window);
+      window = OS_UPGRADE_WINDOW_DEFAULT;
+    }
+  debug_print (1, "Setting OS upgrade window to %d blocks...\n", window);
+  g_atomic_int_set (&os_upgrade_window, window);
+}
+
+gint
+elektron_get_os_upgrade_window ()
+{
+  return g_atomic_int_get (&os_upgrade_window);
+}
+
+//Up to the configured window of blocks are written before waiting for a
+//response. With a window of 1, the default, this is the same stop-and-wait
+//protocol used by the firmware upgrade tools. Larger windows have not been
+//tested on hardware so every response must then carry the offset of the
+//oldest outstanding block.
+//Responses still in flight are drained on any error or early exit.
+
+static gint
+elektron_upgrade_os_blocks (struct backend *backend,
+			    struct sysex_transfer *transfer,
+			    struct elektron_os_image *image)
+{
+  GByteArray *tx_msg, *rx_msg;
+  guint sent, acked, len, offset;
+  guint32 aux32;
+  gboolean active;
+  gint8 op;
+  gint res = 0;
+  guint msg_type = OS_UPGRADE_WRITE_RESPONSE[0] | 0x80;
+  guint window = elektron_get_os_upgrade_window ();
+
+  debug_print (1, "Upgrading OS with a window of %d blocks...\n", window);
+
+  sent = 0;
+  acked = 0;
+  while (acked < image->blocks)
+    {
+      g_mutex_lock (&transfer->mutex);
+      active = transfer->active;
+      g_mutex_unlock (&transfer->mutex);
+      if (!active)
+	{
+	  res = -ECANCELED;
+	  break;
+	}
 
+      while (sent < image->blocks && sent - acked < window)
+	{
+	  len = elektron_get_os_block_len (image, sent);
+	  tx_msg = elektron_new_msg_upgrade_os_write (image->data, len,
+						      sent *
+						      OS_TRANSF_BLOCK_BYTES,
+						      elektron_get_os_block_crc
+						      (image, sent));
+	  res = elektron_tx (backend, tx_msg);
+	  free_msg (tx_msg);
+	  if (res < 0)
+	    {
+	      res = -EIO;
+	      break;
+	    }
+	  res = 0;
+	  sent++;
+	}
+
+      if (res)
+	{
+	  break;
+	}
+
+      rx_msg = elektron_rx (backend, transfer->timeout);
       if (!rx_msg)
 	{
 	  res = -EIO;
 	  break;
 	}
+
+      if (rx_msg->len < 10 || rx_msg->data[4] != msg_type)
+	{
+	  error_print ("Illegal message type in response\n");
+	  free_msg (rx_msg);
+	  res = -EIO;
+	  break;
+	}
+
       //Response: x, x, x, x, 0xd1, int32, [0..3]...
-      op = rx_msg->data[9];
-      if (op == 1)
+      memcpy (&aux32, &rx_msg->data[5], sizeof (guint32));
+      offset = be32toh (aux32);
+      debug_print (2, "Block at %d acknowledged (expected %d)\n", offset,
+		   acked * OS_TRANSF_BLOCK_BYTES);
+      if (window > 1 && offset != acked * OS_TRANSF_BLOCK_BYTES)
 	{
+	  error_print ("Unexpected block acknowledged (%d != %d)\n", offset,
+		       acked * OS_TRANSF_BLOCK_BYTES);
+	  free_msg (rx_msg);
+	  res = -EIO;
 	  break;
 	}
-      else if (op > 1)
+
+      op = rx_msg->data[9];
+      if (op > 1)
 	{
 	  res = -EIO;
 	  error_print ("%s (%s)\n", snd_strerror (res),
@@ -1953,13 +2081,94 @@ elektron_upgrade_os (struct backend *backend, struct sysex_transfer *transfer)
 	  free_msg (rx_msg);
 	  break;
 	}
-
       free_msg (rx_msg);
 
+      acked++;
+      set_sysex_transfer_progress (transfer, acked / (gdouble) image->blocks);
+
+      if (op == 1)
+	{
+	  break;
+	}
+
       usleep (BE_REST_TIME_US);
     }
 
+  if (res || sent > acked)
+    {
+      debug_print (1, "Draining %d pending responses...\n", sent - acked);
+      backend_rx_drain (backend);
+    }
+
+  return res;
+}
+
+static gint
+elektron_upgrade_os (struct backend *backend, const gchar * path,
+		     struct sysex_transfer *transfer)
+{
+  GByteArray *tx_msg;
+  GByteArray *rx_msg;
+  GMappedFile *file;
+  GError *error = NULL;
+  GThread *crc_thread;
+  struct elektron_os_image image;
+  gint8 op;
+  gint res = 0;
+
+  file = g_mapped_file_new (path, FALSE, &error);
+  if (!file)
+    {
+      error_print ("Error while mapping '%s': %s\n", path, error->message);
+      g_error_free (error);
+      return -EIO;
+    }
+
+  image.data = (guint8 *) g_mapped_file_get_contents (file);
+  image.len = g_mapped_file_get_length (file);
+  image.blocks = (image.len + OS_TRANSF_BLOCK_BYTES - 1) /
+    OS_TRANSF_BLOCK_BYTES;
+  image.crcs = g_malloc (sizeof (guint32) * image.blocks);
+  image.ready = 0;
+  g_mutex_init (&image.mutex);
+  g_cond_init (&image.cond);
+
+  crc_thread = g_thread_new ("elektron_os_crc", elektron_os_crc_thread,
+			     &image);
+
+  set_sysex_transfer_progress (transfer, 0.0);
+
+  tx_msg = elektron_new_msg_upgrade_os_start (image.len);
+  rx_msg = elektron_tx_and_rx (backend, tx_msg);
+
+  if (!rx_msg)
+    {
+      res = -EIO;
+      goto end;
+    }
+  //Response: x, x, x, x, 0xd0, [0 (ok), 1 (error)]...
+  op = elektron_get_msg_status (rx_msg);
+  if (op)
+    {
+      res = -EIO;
+      error_print ("%s (%s)\n", snd_strerror (res),
+		   elektron_get_msg_string (rx_msg));
+      free_msg (rx_msg);
+      goto end;
+    }
+
+  free_msg (rx_msg);
+
+  g_mutex_lock (&backend->mutex);
+  res = elektron_upgrade_os_blocks (backend, transfer, &image);
+  g_mutex_unlock (&backend->mutex);
+
 end:
+  g_thread_join (crc_thread);
+  g_mutex_clear (&image.mutex);
+  g_cond_clear (&image.cond);
+  g_free (image.crcs);
+  g_mapped_file_unref (file);
   return res;
 }
 
@@ -2012,7 +2221,8 @@ elektron_get_storage_stats (struct backend *backend, gint type,
 }
 
 gint
-elektron_load_device_desc (struct device_desc *device_desc, guint8 id)
+elektron_load_device_desc (struct device_desc *device_desc,
+			   struct backend_profile *profile, guint8 id)
 {
   gint err, devices;
   JsonParser *parser;
@@ -2149,6 +2359,14 @@ elektron_load_device_desc (struct device_desc *device_desc, guint8 id)
       device_desc->storage = json_reader_get_int_value (reader);
       json_reader_end_member (reader);
 
+      //The profile is optional.
+      if (json_reader_read_member (reader, DEV_TAG_PROFILE)
+	  && json_reader_is_object (reader))
+	{
+	  backend_read_profile (reader, profile);
+	}
+      json_reader_end_member (reader);
+
       break;
     }
 
@@ -2206,7 +2424,8 @@ elektron_handshake (struct backend *backend)
   id = rx_msg->data[5];
   free_msg (rx_msg);
 
-  if (elektron_load_device_desc (&backend->device_desc, id))
+  if (elektron_load_device_desc (&backend->device_desc, &backend->profile,
+				 id))
     {
       backend->data = NULL;
       g_free (overbridge_name);
@@ -2253,7 +2472,10 @@ elektron_handshake (struct backend *backend)
 
   g_free (overbridge_name);
 
-  backend->fs_ops = FS_OPERATIONS;
+  backend->profile.block_len = DATA_TRANSF_BLOCK_BYTES;
+  backend_load_profile (backend, backend->device_desc.name);
+
+  backend->fs_ops = FS_ELEKTRON_OPERATIONS;
   backend->destroy_data = backend_destroy_data;
   backend->upgrade_os = elektron_upgrade_os;
   backend->get_storage_stats = elektron_get_storage_stats;
@@ -2596,7 +2818,7 @@ elektron_open_datum (struct backend *backend, const gchar * path,
     {
       g_byte_array_append (tx_msg, (guint8 *) path_cp1252,
 			   strlen (path_cp1252) + 1);
-      chunk_size = htobe32 (DATA_TRANSF_BLOCK_BYTES);
+      chunk_size = htobe32 (elektron_get_block_len (backend));
       g_byte_array_append (tx_msg, (guint8 *) & chunk_size, sizeof (guint32));
       compression = 1;
       g_byte_array_append (tx_msg, &compression, sizeof (guint8));
@@ -2762,7 +2984,7 @@ elektron_download_data_prefix (struct backend *backend, const gchar * path,
       return -EIO;
     }
 
-  usleep (BE_REST_TIME_US);
+  usleep (backend->profile.rest_time);
 
   jidbe = htobe32 (jid);
 
@@ -2843,7 +3065,7 @@ elektron_download_data_prefix (struct backend *backend, const gchar * path,
 	  g_mutex_unlock (&control->mutex);
 	}
 
-      usleep (BE_REST_TIME_US);
+      usleep (backend->profile.rest_time);
     }
 
   return elektron_close_datum (backend, jid, O_RDONLY, 0);
@@ -2961,7 +3183,7 @@ elektron_download_pkg (struct backend *backend, const gchar * path,
   ret =
     package_receive_pkg_resources (&pkg, path, control, backend, download,
 				   elektron_download_sample_part);
-  ret = ret || package_end (&pkg, output);
+  ret = ret || package_end (&pkg, control);
 
   package_destroy (&pkg);
   return ret;
@@ -3154,7 +3376,7 @@ elektron_upload_data_prefix (struct backend *backend, const gchar * path,
       goto end;
     }
 
-  usleep (BE_REST_TIME_US);
+  usleep (backend->profile.rest_time);
 
   jidbe = htobe32 (jid);
 
@@ -3181,9 +3403,9 @@ elektron_upload_data_prefix (struct backend *backend, const gchar * path,
       aux32 = htobe32 (seq);
       g_byte_array_append (tx_msg, (guint8 *) & aux32, sizeof (guint32));
 
-      if (offset + DATA_TRANSF_BLOCK_BYTES < array->len)
+      if (offset + elektron_get_block_len (backend) < array->len)
 	{
-	  len = DATA_TRANSF_BLOCK_BYTES;
+	  len = elektron_get_block_len (backend);
 	}
       else
 	{
@@ -3206,7 +3428,7 @@ elektron_upload_data_prefix (struct backend *backend, const gchar * path,
 	  goto end;
 	}
 
-      usleep (BE_REST_TIME_US);
+      usleep (backend->profile.rest_time);
 
       if (!elektron_get_msg_status (rx_msg))
 	{
@@ -3289,14 +3511,21 @@ elektron_upload_pkg (struct backend *backend, const gchar * path,
 {
   gint ret;
   struct package pkg;
+  gchar *pkg_path = package_take_path (control);
+
+  if (!pkg_path)
+    {
+      return -EINVAL;
+    }
 
-  ret = package_open (&pkg, input, &backend->device_desc);
+  ret = package_open (&pkg, pkg_path, &backend->device_desc);
   if (!ret)
     {
       ret = package_send_pkg_resources (&pkg, path, control, backend,
 					upload, elektron_upload_sample_part);
       package_close (&pkg);
     }
+  g_free (pkg_path);
   return ret;
 }
 
@@ -3343,8 +3572,10 @@ elektron_sample_load (const gchar * path, GByteArray * sample,
 		      struct job_control *control)
 {
   guint frames;
-  return sample_load_from_file (path, sample, control,
-				&ELEKTRON_SAMPLE_PARAMS, &frames);
+  struct sample_params sample_params = ELEKTRON_SAMPLE_PARAMS;
+  sample_params.trim = TRUE;
+  return sample_load_from_file (path, sample, control, &sample_params,
+				&frames);
 }
 
 gchar *
@@ -24,6 +24,9 @@
 #include "utils.h"
 #include "backend.h"
 
+#define OS_UPGRADE_WINDOW_DEFAULT 1	//Blocks in flight. Only 1 has been tested on hardware.
+#define OS_UPGRADE_WINDOW_MAX 16
+
 enum elektron_fs
 {
   FS_SAMPLES = 0x1,
@@ -34,6 +37,8 @@ enum elektron_fs
   FS_DATA_SND = 0x20
 };
 
+extern const struct fs_operations *FS_ELEKTRON_OPERATIONS[];
+
 gchar *elektron_get_sample_path_from_hash_size (struct backend *, guint32,
 						guint32);
 
@@ -41,4 +46,8 @@ GByteArray *elektron_ping (struct backend *);
 
 gint elektron_handshake (struct backend *);
 
+void elektron_set_os_upgrade_window (gint);
+
+gint elektron_get_os_upgrade_window ();
+
 #endif
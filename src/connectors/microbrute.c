@@ -32,6 +32,7 @@
 #define MICROBRUTE_SEQUENCE_RESPONSE_LEN_POS 11
 #define MICROBRUTE_SEQUENCE_RESPONSE_DATA_POS 12
 #define MICROBRUTE_SEQUENCE_TXT_POS 2
+#define MICROBRUTE_RTT_SEQUENCE 0	//Request type for the timeout estimation
 
 static const guint8 ARTURIA_ID[] = { 0x0, 0x20, 0x6b };
 static const guint8 FAMILY_ID[] = { 0x4, 0x0 };
@@ -137,19 +138,16 @@ microbrute_get_sequence_request_msg (struct backend *backend, guint8 id,
 }
 
 static gint
-microbrute_download_seq_data (struct backend *backend, guint seqnum,
-			      guint offset, gchar * sequence)
+microbrute_append_seq_data (GByteArray * rx_msg, guint offset,
+			    gchar * sequence)
 {
-  GByteArray *tx_msg, *rx_msg;
   gchar aux[LABEL_MAX];
   gboolean first;
   guint8 *step;
 
-  tx_msg = microbrute_get_sequence_request_msg (backend, seqnum - 1, offset);
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, -1);
-  if (!rx_msg)
+  if (rx_msg->len <= MICROBRUTE_SEQUENCE_RESPONSE_DATA_POS)
     {
-      return -EIO;
+      return -EINVAL;
     }
 
   first = offset ? FALSE : TRUE;
@@ -171,8 +169,61 @@ microbrute_download_seq_data (struct backend *backend, guint seqnum,
       step++;
     }
 
+  return 0;
+}
+
+static gint
+microbrute_download_seq_data (struct backend *backend, guint seqnum,
+			      guint offset, gchar * sequence)
+{
+  gint err;
+  GByteArray *tx_msg, *rx_msg;
+
+  tx_msg = microbrute_get_sequence_request_msg (backend, seqnum - 1, offset);
+  rx_msg = backend_tx_and_rx_sysex_rtt (backend, tx_msg,
+				       MICROBRUTE_RTT_SEQUENCE,
+				       backend->profile.timeout);
+  if (!rx_msg)
+    {
+      return -EIO;
+    }
+
+  err = microbrute_append_seq_data (rx_msg, offset, sequence);
   free_msg (rx_msg);
 
+  return err;
+}
+
+static guint
+microbrute_get_seqnum (const gchar * src_path)
+{
+  gchar *src_path_copy = strdup (src_path);
+  gchar *filename = basename (src_path_copy);
+  guint seqnum = atoi (filename);
+  g_free (src_path_copy);
+  return seqnum;
+}
+
+static gint
+microbrute_download_end (GByteArray * output, gchar * sequence,
+			 struct job_control *control)
+{
+  gboolean active;
+
+  g_mutex_lock (&control->mutex);
+  active = control->active;
+  g_mutex_unlock (&control->mutex);
+  if (active)
+    {
+      set_job_control_progress (control, 1.0);
+    }
+  else
+    {
+      return -ECANCELED;
+    }
+
+  g_byte_array_append (output, (guint8 *) sequence, strlen (sequence));
+
   return 0;
 }
 
@@ -181,14 +232,9 @@ microbrute_download (struct backend *backend, const gchar * src_path,
 		     GByteArray * output, struct job_control *control)
 {
   gchar sequence[MICROBRUTE_MAX_SEQ_STR_LEN];
-  gboolean active;
-  gchar *src_path_copy = strdup (src_path);
-  gchar *filename = basename (src_path_copy);
-  guint seqnum = atoi (filename);
+  guint seqnum = microbrute_get_seqnum (src_path);
   gint err;
 
-  g_free (src_path_copy);
-
   snprintf (sequence, MICROBRUTE_MAX_SEQ_STR_LEN, "%1d:", seqnum);
 
   control->parts = 1;
@@ -209,21 +255,87 @@ microbrute_download (struct backend *backend, const gchar * src_path,
       return err;
     }
 
-  g_mutex_lock (&control->mutex);
-  active = control->active;
-  g_mutex_unlock (&control->mutex);
-  if (active)
+  return microbrute_download_end (output, sequence, control);
+}
+
+//Used in ranges, where the caller holds the backend. Both halves are requested before receiving the first one.
+static gint
+microbrute_download_locked (struct backend *backend, const gchar * src_path,
+			    GByteArray * output, struct job_control *control)
+{
+  gchar sequence[MICROBRUTE_MAX_SEQ_STR_LEN];
+  guint seqnum = microbrute_get_seqnum (src_path);
+  struct sysex_transfer transfer;
+  guint offsets[] = { 0, 0x20 };
+  gint err;
+
+  snprintf (sequence, MICROBRUTE_MAX_SEQ_STR_LEN, "%1d:", seqnum);
+
+  control->parts = 1;
+  control->part = 0;
+  set_job_control_progress (control, 0.0);
+
+  for (gint i = 0; i < G_N_ELEMENTS (offsets); i++)
     {
-      set_job_control_progress (control, 1.0);
+      transfer.raw = microbrute_get_sequence_request_msg (backend,
+							  seqnum - 1,
+							  offsets[i]);
+      err = backend_tx_sysex (backend, &transfer);
+      free_msg (transfer.raw);
+      if (err < 0)
+	{
+	  return err;
+	}
     }
-  else
+
+  for (gint i = 0; i < G_N_ELEMENTS (offsets); i++)
     {
-      return -ECANCELED;
+      transfer.timeout = backend->profile.timeout;
+      transfer.batch = FALSE;
+      backend_rx_sysex (backend, &transfer);
+      if (!transfer.raw)
+	{
+	  return -EIO;
+	}
+
+      //The responses must come in the same order as the requests.
+      if (transfer.raw->len <= MICROBRUTE_SEQUENCE_RESPONSE_DATA_POS
+	  || transfer.raw->data[MICROBRUTE_SEQUENCE_REQUEST_OFFSET_POS] !=
+	  offsets[i])
+	{
+	  free_msg (transfer.raw);
+	  return -EIO;
+	}
+
+      err = microbrute_append_seq_data (transfer.raw, offsets[i], sequence);
+      free_msg (transfer.raw);
+      if (err)
+	{
+	  return err;
+	}
+
+      set_job_control_progress (control, (i + 1) * 0.5);
     }
 
-  g_byte_array_append (output, (guint8 *) sequence, strlen (sequence));
+  return microbrute_download_end (output, sequence, control);
+}
 
-  return 0;
+//All the sequences are transferred while holding the backend so there is a single drain and no other message can get
+//in between.
+static gint
+microbrute_download_range (struct backend *backend, GPtrArray * paths,
+			   fs_range_item_func item,
+			   struct job_control *control, void *data)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  backend_rx_drain (backend);
+  err = backend_run_range (backend, paths, microbrute_download_locked, FALSE,
+			   item, control, data);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
 }
 
 static GByteArray *
@@ -315,8 +427,8 @@ microbrute_send_seq_msg (struct backend *backend, guint8 seqnum,
 }
 
 static gint
-microbrute_upload (struct backend *backend, const gchar * path,
-		   GByteArray * input, struct job_control *control)
+microbrute_upload_locked (struct backend *backend, const gchar * path,
+			  GByteArray * input, struct job_control *control)
 {
   gchar *token = (gchar *) & input->data[MICROBRUTE_SEQUENCE_TXT_POS];
   gint pos = MICROBRUTE_SEQUENCE_TXT_POS;
@@ -328,8 +440,6 @@ microbrute_upload (struct backend *backend, const gchar * path,
       return -EBADSLT;
     }
 
-  g_mutex_lock (&backend->mutex);
-
   control->parts = 1;
   control->part = 0;
   set_job_control_progress (control, 0.0);
@@ -354,10 +464,37 @@ microbrute_upload (struct backend *backend, const gchar * path,
   set_job_control_progress (control, 1.0);
 
 end:
-  g_mutex_unlock (&backend->mutex);
   return steps < 0 ? steps : 0;
 }
 
+static gint
+microbrute_upload (struct backend *backend, const gchar * path,
+		   GByteArray * input, struct job_control *control)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  err = microbrute_upload_locked (backend, path, input, control);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
+}
+
+static gint
+microbrute_upload_range (struct backend *backend, GPtrArray * paths,
+			 fs_range_item_func item,
+			 struct job_control *control, void *data)
+{
+  gint err;
+
+  g_mutex_lock (&backend->mutex);
+  err = backend_run_range (backend, paths, microbrute_upload_locked, TRUE,
+			   item, control, data);
+  g_mutex_unlock (&backend->mutex);
+
+  return err;
+}
+
 static void
 microbrute_print (struct item_iterator *iter, struct backend *backend)
 {
@@ -376,6 +513,8 @@ static const struct fs_operations FS_MICROBRUTE_OPERATIONS = {
   .print_item = microbrute_print,
   .download = microbrute_download,
   .upload = microbrute_upload,
+  .download_range = microbrute_download_range,
+  .upload_range = microbrute_upload_range,
   .get_id = get_item_name,
   .load = load_file,
   .save = save_file,
@@ -384,7 +523,7 @@ static const struct fs_operations FS_MICROBRUTE_OPERATIONS = {
   .get_download_path = microbrute_get_download_path
 };
 
-static const struct fs_operations *FS_MICROBRUTE_OPERATIONS_LIST[] = {
+const struct fs_operations *FS_MICROBRUTE_OPERATIONS_LIST[] = {
   &FS_MICROBRUTE_OPERATIONS, NULL
 };
 
@@ -412,5 +551,7 @@ microbrute_handshake (struct backend *backend)
 	    backend->midi_info.version[0], backend->midi_info.version[1],
 	    backend->midi_info.version[2], backend->midi_info.version[3]);
 
+  backend_load_profile (backend, "Arturia MicroBrute");
+
   return 0;
 }
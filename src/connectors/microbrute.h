@@ -23,6 +23,8 @@
 
 #include "backend.h"
 
+extern const struct fs_operations *FS_MICROBRUTE_OPERATIONS_LIST[];
+
 gint microbrute_handshake (struct backend *);
 
 #endif
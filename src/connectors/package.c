@@ -20,6 +20,8 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 #include "package.h"
 #include "utils.h"
@@ -43,15 +45,100 @@
 #define MAN_TAG_HASH "hash"
 #define MAN_TAG_SIZE "size"
 
-#define MAX_PACKAGE_LEN (64 * 1024 * 1024)
-#define MAX_MANIFEST_LEN (128 * 1024)
+#define PKG_DECODE_AHEAD 2
 #define MANIFEST_FILENAME "manifest.json"
+#define SPOOL_DIR_TEMPLATE PACKAGE "-pkg-XXXXXX"
+#define SPOOL_ZIP_FILENAME "package.zip"
+#define SPOOL_ZIP_TEMPLATE PACKAGE "-pkg-XXXXXX.zip"
 
 const struct sample_params ELEKTRON_SAMPLE_PARAMS = {
   .samplerate = ELEKTRON_SAMPLE_RATE,
-  .channels = ELEKTRON_SAMPLE_CHANNELS
+  .channels = ELEKTRON_SAMPLE_CHANNELS,
+  .trim = FALSE
 };
 
+//While writing, every resource is spooled to a file in the temporary directory
+//and its data is released, so only one resource needs to be in memory at once.
+//libzip reads these files when the archive is closed.
+
+static zip_source_t *
+package_spool_resource (struct package *pkg,
+			struct package_resource *pkg_resource,
+			zip_error_t * zerror)
+{
+  gchar name[LABEL_MAX];
+  gchar *path;
+  zip_source_t *source;
+
+  snprintf (name, LABEL_MAX, "%u", pkg->spooled);
+  pkg->spooled++;
+  path = chain_path (pkg->tmp_dir, name);
+
+  if (save_file_char (path, pkg_resource->data->data,
+		      pkg_resource->data->len))
+    {
+      error_print ("Error while spooling file %s\n", pkg_resource->path);
+      g_free (path);
+      return NULL;
+    }
+
+  source = zip_source_file_create (path, 0, -1, zerror);
+  g_free (path);
+  return source;
+}
+
+//PCM audio barely shrinks with deflate so samples are stored. The payload and
+//the manifest are deflated with the configured level, being 0 the default.
+
+static gint package_compression_level = 0;
+
+void
+package_set_compression_level (gint level)
+{
+  if (level < 0 || level > PKG_MAX_COMPRESSION_LEVEL)
+    {
+      error_print ("Invalid compression level %d. Using default...\n",
+		   level);
+      level = 0;
+    }
+  debug_print (1, "Setting package compression level to %d...\n", level);
+  g_atomic_int_set (&package_compression_level, level);
+}
+
+gint
+package_get_compression_level ()
+{
+  return g_atomic_int_get (&package_compression_level);
+}
+
+static gint
+package_set_compression (struct package *pkg, zip_int64_t index,
+			 struct package_resource *pkg_resource)
+{
+  zip_int32_t method;
+  zip_uint32_t level;
+
+  if (pkg_resource->type == PKG_RES_TYPE_SAMPLE)
+    {
+      method = ZIP_CM_STORE;
+      level = 0;
+    }
+  else
+    {
+      method = ZIP_CM_DEFLATE;
+      level = pkg->compression_level;
+    }
+
+  if (zip_set_file_compression (pkg->zip, index, method, level))
+    {
+      error_print ("Error while setting compression: %s\n",
+		   zip_error_strerror (zip_get_error (pkg->zip)));
+      return -1;
+    }
+
+  return 0;
+}
+
 static gint
 package_add_resource (struct package *pkg,
 		      struct package_resource *pkg_resource, gboolean new)
@@ -62,9 +149,9 @@ package_add_resource (struct package *pkg,
 
   debug_print (1, "Adding file %s to zip (%d B)...\n", pkg_resource->path,
 	       pkg_resource->data->len);
-  sample_source =
-    zip_source_buffer_create (pkg_resource->data->data,
-			      pkg_resource->data->len, 0, &zerror);
+
+  zip_error_init (&zerror);
+  sample_source = package_spool_resource (pkg, pkg_resource, &zerror);
   if (!sample_source)
     {
       error_print ("Error while creating file source: %s\n",
@@ -84,6 +171,14 @@ package_add_resource (struct package *pkg,
       return -1;
     }
 
+  if (package_set_compression (pkg, index, pkg_resource))
+    {
+      return -1;
+    }
+
+  g_byte_array_free (pkg_resource->data, TRUE);
+  pkg_resource->data = NULL;
+
   if (new)
     {
       pkg->resources = g_list_append (pkg->resources, pkg_resource);
@@ -92,51 +187,97 @@ package_add_resource (struct package *pkg,
   return 0;
 }
 
+static void
+package_remove_tmp_dir (struct package *pkg)
+{
+  GDir *dir;
+  gchar *path;
+  const gchar *name;
+
+  if (!pkg->tmp_dir)
+    {
+      return;
+    }
+
+  dir = g_dir_open (pkg->tmp_dir, 0, NULL);
+  if (dir)
+    {
+      while ((name = g_dir_read_name (dir)))
+	{
+	  path = chain_path (pkg->tmp_dir, name);
+	  g_unlink (path);
+	  g_free (path);
+	}
+      g_dir_close (dir);
+    }
+
+  g_rmdir (pkg->tmp_dir);
+  g_free (pkg->tmp_dir);
+  pkg->tmp_dir = NULL;
+}
 
 gint
 package_begin (struct package *pkg, gchar * name, const gchar * fw_version,
 	       const struct device_desc *device_desc, enum package_type type)
 {
+  gint zerr;
+  gchar *zip_path;
   zip_error_t zerror;
+  GError *error = NULL;
+
   pkg->resources = NULL;
-  pkg->buff = g_malloc (MAX_PACKAGE_LEN);
+  pkg->zip_source = NULL;
+  pkg->mapped_file = NULL;
+  pkg->spooled = 0;
+  pkg->compression_level = package_get_compression_level ();
   pkg->name = name;
   pkg->fw_version = strdup (fw_version);
   pkg->device_desc = device_desc;
   pkg->type = type;
 
-  debug_print (1, "Creating zip buffer...\n");
-
-  zip_error_init (&zerror);
-  pkg->zip_source =
-    zip_source_buffer_create (pkg->buff, MAX_PACKAGE_LEN, 0, &zerror);
-  if (!pkg->zip_source)
+  pkg->tmp_dir = g_dir_make_tmp (SPOOL_DIR_TEMPLATE, &error);
+  if (!pkg->tmp_dir)
     {
-      error_print ("Error while creating zip source: %s\n",
-		   zip_error_strerror (&zerror));
-      zip_error_fini (&zerror);
-      g_free (pkg->buff);
+      error_print ("Error while creating temporary directory: %s\n",
+		   error->message);
+      g_error_free (error);
+      g_free (pkg->fw_version);
       return -1;
     }
 
-  pkg->zip = zip_open_from_source (pkg->zip_source, ZIP_TRUNCATE, &zerror);
+  zip_path = chain_path (pkg->tmp_dir, SPOOL_ZIP_FILENAME);
+  debug_print (1, "Creating zip file %s...\n", zip_path);
+
+  pkg->zip = zip_open (zip_path, ZIP_CREATE | ZIP_TRUNCATE, &zerr);
+  g_free (zip_path);
   if (!pkg->zip)
     {
-      error_print ("Error while creating in memory zip: %s\n",
+      zip_error_init_with_code (&zerror, zerr);
+      error_print ("Error while creating zip: %s\n",
 		   zip_error_strerror (&zerror));
       zip_error_fini (&zerror);
-      zip_source_free (pkg->zip_source);
-      g_free (pkg->buff);
+      package_remove_tmp_dir (pkg);
+      g_free (pkg->fw_version);
       return -1;
     }
 
-  zip_source_keep (pkg->zip_source);
-
+  //The manifest goes first in the zip but it is only known at the end.
   pkg->manifest = g_malloc (sizeof (struct package_resource));
   pkg->manifest->type = PKG_RES_TYPE_MANIFEST;
-  pkg->manifest->data = g_byte_array_sized_new (MAX_MANIFEST_LEN);	//We need this because we can not resize later.
+  pkg->manifest->data = g_byte_array_new ();
   pkg->manifest->path = strdup (MANIFEST_FILENAME);
-  package_add_resource (pkg, pkg->manifest, TRUE);
+  if (package_add_resource (pkg, pkg->manifest, TRUE))
+    {
+      error_print ("Error while adding %s\n", MANIFEST_FILENAME);
+      g_byte_array_free (pkg->manifest->data, TRUE);
+      g_free (pkg->manifest->path);
+      g_free (pkg->manifest);
+      zip_discard (pkg->zip);
+      pkg->zip = NULL;
+      package_remove_tmp_dir (pkg);
+      g_free (pkg->fw_version);
+      return -1;
+    }
 
   return 0;
 }
@@ -148,7 +289,7 @@ package_add_manifest (struct package *pkg)
   JsonGenerator *gen;
   JsonNode *root;
   gchar *json;
-  gint len;
+  gint len, ret;
   gchar *val = g_malloc (LABEL_MAX);
   GList *resource;
   gboolean samples_found = FALSE;
@@ -232,24 +373,28 @@ package_add_manifest (struct package *pkg)
   json = json_generator_to_data (gen, NULL);
 
   len = strlen (json);
-  memcpy (pkg->manifest->data->data, json, len);
-  pkg->manifest->data->len = len;
-  package_add_resource (pkg, pkg->manifest, FALSE);
+  pkg->manifest->data = g_byte_array_new_take ((guint8 *) json, len);
+  ret = package_add_resource (pkg, pkg->manifest, FALSE);
 
-  g_free (json);
   json_node_free (root);
   g_object_unref (gen);
   g_object_unref (builder);
   g_free (val);
 
-  return 0;
+  return ret;
 }
 
+//The zip is not loaded into memory. It is moved out of the spool directory,
+//which is removed with the package, and its path is passed in control->data
+//to package_save, which moves it into place.
+
 gint
-package_end (struct package *pkg, GByteArray * out)
+package_end (struct package *pkg, struct job_control *control)
 {
-  int ret = 0;
-  zip_stat_t zstat;
+  gint ret, fd;
+  gchar *zip_path, *path;
+  gint64 start;
+  GError *error = NULL;
 
   ret = package_add_manifest (pkg);
   if (ret)
@@ -258,112 +403,290 @@ package_end (struct package *pkg, GByteArray * out)
       return ret;
     }
 
-  debug_print (1, "Writing zip to buffer...\n");
+  debug_print (1, "Writing zip file...\n");
+  start = g_get_monotonic_time ();
   if (zip_close (pkg->zip))
     {
-      error_print ("Error while creating in memory zip: %s\n",
+      error_print ("Error while creating zip: %s\n",
 		   zip_error_strerror (zip_get_error (pkg->zip)));
       return -1;
     }
+  pkg->zip = NULL;
+  debug_print (1, "Zip file written in %.3f s\n",
+	       (g_get_monotonic_time () - start) / 1e6);
 
-  zip_source_stat (pkg->zip_source, &zstat);
-  debug_print (1, "%ld B written to package\n", zstat.comp_size);
+  fd = g_file_open_tmp (SPOOL_ZIP_TEMPLATE, &path, &error);
+  if (fd < 0)
+    {
+      error_print ("Error while creating temporary file: %s\n",
+		   error->message);
+      g_error_free (error);
+      return -EIO;
+    }
+  close (fd);
+
+  zip_path = chain_path (pkg->tmp_dir, SPOOL_ZIP_FILENAME);
+  ret = g_rename (zip_path, path) ? -errno : 0;
+  g_free (zip_path);
+  if (ret)
+    {
+      error_print ("Error while moving zip file: %s\n", g_strerror (-ret));
+      g_unlink (path);
+      g_free (path);
+      return ret;
+    }
 
-  zip_source_open (pkg->zip_source);
-  g_byte_array_set_size (out, zstat.comp_size);
-  zip_source_read (pkg->zip_source, out->data, zstat.comp_size);
-  zip_source_close (pkg->zip_source);
+  g_free (control->data);
+  control->data = path;
 
   return 0;
 }
 
+//The package written by package_end is moved into place. If the destination
+//is in another filesystem, the file is copied from a mapped file.
+
+gint
+package_save (const gchar * path, GByteArray * array,
+	      struct job_control *control)
+{
+  gint ret;
+  mode_t mask;
+  GMappedFile *mapped_file;
+  GError *error = NULL;
+  gchar *zip_path = package_take_path (control);
+
+  if (!zip_path)
+    {
+      return save_file (path, array, control);
+    }
+
+  debug_print (1, "Moving %s to %s...\n", zip_path, path);
+
+  //Temporary files are only readable by the user but the package is moved
+  //into place, so it gets the same permissions a new file would get.
+  mask = umask (0);
+  umask (mask);
+  if (g_chmod (zip_path, 0666 & ~mask))
+    {
+      debug_print (1, "Error while setting file permissions: %s\n",
+		   g_strerror (errno));
+    }
+
+  ret = g_rename (zip_path, path) ? -errno : 0;
+  if (ret == -EXDEV)
+    {
+      mapped_file = g_mapped_file_new (zip_path, FALSE, &error);
+      if (mapped_file)
+	{
+	  ret = save_file_char (path, (guint8 *)
+				g_mapped_file_get_contents (mapped_file),
+				g_mapped_file_get_length (mapped_file));
+	  g_mapped_file_unref (mapped_file);
+	}
+      else
+	{
+	  error_print ("Error while reading zip file: %s\n", error->message);
+	  g_error_free (error);
+	  ret = -EIO;
+	}
+    }
+
+  if (ret)
+    {
+      error_print ("Error while saving package to '%s': %s\n", path,
+		   g_strerror (-ret));
+    }
+
+  g_unlink (zip_path);
+  g_free (zip_path);
+
+  return ret;
+}
+
 void
 package_free_package_resource (gpointer data)
 {
   struct package_resource *pkg_resource = data;
-  g_byte_array_free (pkg_resource->data, TRUE);
+  if (pkg_resource->data)
+    {
+      g_byte_array_free (pkg_resource->data, TRUE);
+    }
+  g_free (pkg_resource->path);
   g_free (pkg_resource);
 }
 
 void
 package_destroy (struct package *pkg)
 {
-  zip_source_free (pkg->zip_source);
-  g_free (pkg->buff);
+  if (pkg->zip)
+    {
+      zip_discard (pkg->zip);
+    }
+  if (pkg->zip_source)
+    {
+      zip_source_free (pkg->zip_source);
+    }
+  package_remove_tmp_dir (pkg);
+  if (pkg->mapped_file)
+    {
+      g_mapped_file_unref (pkg->mapped_file);
+    }
   g_free (pkg->name);
   g_free (pkg->fw_version);
   g_list_free_full (pkg->resources, package_free_package_resource);
 }
 
+static gint
+package_read_file (struct package *pkg, const gchar * path,
+		   GByteArray * data)
+{
+  zip_stat_t zstat;
+  zip_file_t *zip_file;
+  zip_int64_t len;
+
+  if (zip_stat (pkg->zip, path, ZIP_FL_ENC_STRICT, &zstat))
+    {
+      error_print ("Error while loading '%s': %s\n", path,
+		   zip_error_strerror (zip_get_error (pkg->zip)));
+      return -1;
+    }
+
+  zip_file = zip_fopen (pkg->zip, path, 0);
+  if (!zip_file)
+    {
+      error_print ("Error while opening '%s': %s\n", path,
+		   zip_error_strerror (zip_get_error (pkg->zip)));
+      return -1;
+    }
+
+  g_byte_array_set_size (data, zstat.size);
+  len = zip_fread (zip_file, data->data, zstat.size);
+  zip_fclose (zip_file);
+
+  if (len != zstat.size)
+    {
+      error_print ("Error while reading '%s'\n", path);
+      return -1;
+    }
+
+  return 0;
+}
+
+//The package is not loaded into memory as the zip is read straight from the
+//mapped file. Resources are only extracted when they are about to be sent.
+
 gint
-package_open (struct package *pkg, GByteArray * data,
+package_open (struct package *pkg, const gchar * path,
 	      const struct device_desc *device_desc)
 {
-  gint ret;
+  GError *error = NULL;
   zip_error_t zerror;
-  zip_file_t *manifest_file;
-  zip_stat_t zstat;
 
-  debug_print (1, "Opening zip stream...\n");
+  pkg->resources = NULL;
+  pkg->tmp_dir = NULL;
+  pkg->zip = NULL;
+  pkg->zip_source = NULL;
+  pkg->name = NULL;
+  pkg->fw_version = NULL;
+  pkg->device_desc = device_desc;
+
+  debug_print (1, "Mapping file %s...\n", path);
+
+  pkg->mapped_file = g_mapped_file_new (path, FALSE, &error);
+  if (!pkg->mapped_file)
+    {
+      error_print ("Error while mapping file: %s\n", error->message);
+      g_error_free (error);
+      return -1;
+    }
 
   zip_error_init (&zerror);
   pkg->zip_source =
-    zip_source_buffer_create (data->data, data->len, 0, &zerror);
+    zip_source_buffer_create (g_mapped_file_get_contents (pkg->mapped_file),
+			      g_mapped_file_get_length (pkg->mapped_file), 0,
+			      &zerror);
   if (!pkg->zip_source)
     {
       error_print ("Error while creating zip source: %s\n",
 		   zip_error_strerror (&zerror));
       zip_error_fini (&zerror);
+      package_destroy (pkg);
       return -1;
     }
 
   pkg->zip = zip_open_from_source (pkg->zip_source, ZIP_RDONLY, &zerror);
   if (!pkg->zip)
     {
-      error_print ("Error while creating in memory zip: %s\n",
+      error_print ("Error while opening zip: %s\n",
 		   zip_error_strerror (&zerror));
       zip_error_fini (&zerror);
-      zip_source_free (pkg->zip_source);
-      return -1;
-    }
-
-  ret = zip_stat (pkg->zip, MANIFEST_FILENAME, ZIP_FL_ENC_STRICT, &zstat);
-  if (ret)
-    {
-      error_print ("Error while loading '%s': %s\n", MANIFEST_FILENAME,
-		   zip_error_strerror (&zerror));
-      zip_error_fini (&zerror);
-      zip_source_free (pkg->zip_source);
-      zip_close (pkg->zip);
+      package_destroy (pkg);
       return -1;
     }
+  pkg->zip_source = NULL;	//Now owned by the zip.
 
   pkg->manifest = g_malloc (sizeof (struct package_resource));
   pkg->manifest->type = PKG_RES_TYPE_MANIFEST;
-  pkg->manifest->data = g_byte_array_sized_new (zstat.size);
+  pkg->manifest->data = g_byte_array_new ();
   pkg->manifest->path = strdup (MANIFEST_FILENAME);
-  manifest_file = zip_fopen (pkg->zip, MANIFEST_FILENAME, 0);
-  zip_fread (manifest_file, pkg->manifest->data->data, zstat.size);
-  pkg->manifest->data->len = zstat.size;
-  zip_fclose (manifest_file);
-
-  pkg->resources = NULL;
   pkg->resources = g_list_append (pkg->resources, pkg->manifest);
-  pkg->buff = NULL;
-  pkg->name = NULL;
-  pkg->fw_version = NULL;
-  pkg->device_desc = device_desc;
 
-  return ret;
+  if (package_read_file (pkg, MANIFEST_FILENAME, pkg->manifest->data))
+    {
+      package_destroy (pkg);
+      return -1;
+    }
+
+  return 0;
 }
 
 void
 package_close (struct package *pkg)
 {
-  zip_source_close (pkg->zip_source);
   package_destroy (pkg);
 }
 
+//Packages are read from the file while uploading so only the path is needed.
+//This is passed in control->data, which must be freed by the caller as any
+//other data there, and the array is left empty.
+//The same channel is used from package_end to package_save.
+
+gint
+package_load (const gchar * path, GByteArray * array,
+	      struct job_control *control)
+{
+  g_byte_array_set_size (array, 0);
+  g_free (control->data);
+  control->data = g_strdup (path);
+  return 0;
+}
+
+//The path is taken from control->data, which is free to use afterwards.
+
+gchar *
+package_take_path (struct job_control *control)
+{
+  gchar *path = control->data;
+  control->data = NULL;
+  return path;
+}
+
+//A downloaded package that is not going to be saved must be removed as
+//package_end leaves it in the temporary directory.
+
+void
+package_discard (struct job_control *control)
+{
+  gchar *zip_path = package_take_path (control);
+
+  if (zip_path)
+    {
+      debug_print (1, "Removing %s...\n", zip_path);
+      g_unlink (zip_path);
+      g_free (zip_path);
+    }
+}
+
 gint
 package_receive_pkg_resources (struct package *pkg,
 			       const gchar * payload_path,
@@ -544,6 +867,121 @@ get_payload:
   return ret;
 }
 
+struct package_sample_job
+{
+  gchar *path;
+  gboolean known;
+  guint32 hash;
+  guint32 size;
+  GByteArray *wave;
+  GByteArray *raw;
+  guint frames;
+  struct job_control control;
+  gint err;
+  gboolean done;
+  GMutex mutex;
+  GCond cond;
+};
+
+//Hashes are stored as strings in the manifest but integers are accepted too.
+
+static gboolean
+package_read_uint_member (JsonReader * reader, const gchar * member,
+			  guint32 * value)
+{
+  JsonNode *node;
+  gboolean found = FALSE;
+
+  if (json_reader_read_member (reader, member))
+    {
+      node = json_reader_get_value (reader);
+      if (node && json_node_get_value_type (node) == G_TYPE_STRING)
+	{
+	  *value = g_ascii_strtoll (json_node_get_string (node), NULL, 10);
+	  found = TRUE;
+	}
+      else if (node)
+	{
+	  *value = json_node_get_int (node);
+	  found = TRUE;
+	}
+    }
+  json_reader_end_member (reader);
+
+  return found;
+}
+
+static struct package_sample_job *
+package_new_sample_job (JsonReader * reader)
+{
+  struct package_sample_job *job;
+  const gchar *path;
+
+  if (!json_reader_read_member (reader, PKG_TAG_FILE_NAME))
+    {
+      json_reader_end_member (reader);
+      return NULL;
+    }
+  path = json_reader_get_string_value (reader);
+  json_reader_end_member (reader);
+  if (!path)
+    {
+      return NULL;
+    }
+
+  job = g_malloc0 (sizeof (struct package_sample_job));
+  job->path = strdup (path);
+  job->known = package_read_uint_member (reader, PKG_TAG_HASH, &job->hash)
+    && package_read_uint_member (reader, PKG_TAG_FILE_SIZE, &job->size);
+  job->raw = g_byte_array_new ();
+  job->control.active = TRUE;
+  job->control.data = NULL;
+  g_mutex_init (&job->control.mutex);
+  g_mutex_init (&job->mutex);
+  g_cond_init (&job->cond);
+
+  return job;
+}
+
+static void
+package_free_sample_job (gpointer data)
+{
+  struct package_sample_job *job = data;
+
+  g_free (job->path);
+  if (job->wave)
+    {
+      g_byte_array_free (job->wave, TRUE);
+    }
+  if (job->raw)
+    {
+      g_byte_array_free (job->raw, TRUE);
+    }
+  g_free (job->control.data);
+  g_mutex_clear (&job->control.mutex);
+  g_mutex_clear (&job->mutex);
+  g_cond_clear (&job->cond);
+  g_free (job);
+}
+
+static void
+package_decode_sample (gpointer data, gpointer user_data)
+{
+  gint err;
+  struct package_sample_job *job = data;
+
+  err = sample_load_from_array (job->wave, job->raw, &job->control,
+				&ELEKTRON_SAMPLE_PARAMS, &job->frames);
+  g_byte_array_free (job->wave, TRUE);
+  job->wave = NULL;
+
+  g_mutex_lock (&job->mutex);
+  job->err = err;
+  job->done = TRUE;
+  g_cond_signal (&job->cond);
+  g_mutex_unlock (&job->mutex);
+}
+
 gint
 package_send_pkg_resources (struct package *pkg,
 			    const gchar * payload_path,
@@ -552,19 +990,19 @@ package_send_pkg_resources (struct package *pkg,
 			    fs_remote_file_op upload_data,
 			    fs_remote_file_op upload_sample)
 {
-  gint elements, i, ret = 0;
-  const gchar *file_type, *sample_path;
+  gint elements, i, err, ret = 0;
+  const gchar *file_type;
   gint64 product_type;
   JsonParser *parser;
   JsonReader *reader;
   GError *error;
-  zip_stat_t zstat;
-  zip_error_t zerror;
-  zip_file_t *zip_file;
-  GByteArray *wave, *raw;
-  struct package_resource *pkg_resource;
-
-  zip_error_init (&zerror);
+  gboolean active;
+  guint next;
+  gchar *existing_path;
+  GByteArray *payload;
+  GPtrArray *jobs;
+  GThreadPool *pool;
+  struct package_sample_job *job;
 
   parser = json_parser_new ();
   if (!json_parser_load_from_data
@@ -593,29 +1031,18 @@ package_send_pkg_resources (struct package *pkg,
   pkg->name = strdup (json_reader_get_string_value (reader));
   json_reader_end_element (reader);
 
-  if (zip_stat (pkg->zip, pkg->name, ZIP_FL_ENC_STRICT, &zstat))
+  payload = g_byte_array_new ();
+  if (package_read_file (pkg, pkg->name, payload))
     {
-      error_print ("Error while loading '%s': %s\n", MANIFEST_FILENAME,
-		   zip_error_strerror (&zerror));
-      zip_error_fini (&zerror);
+      g_byte_array_free (payload, TRUE);
       ret = -1;
       goto cleanup_reader;
     }
 
-  pkg_resource = g_malloc (sizeof (struct package_resource));
-  pkg_resource->type = PKG_RES_TYPE_PAYLOAD;
-  pkg_resource->data = g_byte_array_sized_new (zstat.size);
-  pkg_resource->path = strdup (pkg->name);
-  zip_file = zip_fopen (pkg->zip, pkg->name, 0);
-  zip_fread (zip_file, pkg_resource->data->data, zstat.size);
-  pkg_resource->data->len = zstat.size;
-  zip_fclose (zip_file);
-
-  pkg->resources = g_list_append (pkg->resources, pkg_resource);
-
   control->parts = 129;		// 128 sample slots and main.
   control->part = 0;
-  ret = upload_data (backend, payload_path, pkg_resource->data, control);
+  ret = upload_data (backend, payload_path, payload, control);
+  g_byte_array_free (payload, TRUE);
   if (ret)
     {
       error_print ("Error while uploading payload to '%s'\n", payload_path);
@@ -707,69 +1134,112 @@ package_send_pkg_resources (struct package *pkg,
       goto cleanup_reader;
     }
 
-  wave = g_byte_array_sized_new (zstat.size);
-  raw = g_byte_array_sized_new (MAX_PACKAGE_LEN);
   elements = json_reader_count_elements (reader);
-  control->parts = elements + 1;
-  control->part = 1;
-  for (i = 0; i < elements; i++, control->part++)
+  jobs = g_ptr_array_new_with_free_func (package_free_sample_job);
+  for (i = 0; i < elements; i++)
     {
-      guint frames;
-
       json_reader_read_element (reader, i);
-      json_reader_read_member (reader, PKG_TAG_FILE_NAME);
-      sample_path = json_reader_get_string_value (reader);
-      json_reader_end_element (reader);
+      job = package_new_sample_job (reader);
       json_reader_end_element (reader);
 
-      if (zip_stat (pkg->zip, sample_path, ZIP_FL_ENC_STRICT, &zstat))
+      if (!job)
 	{
-	  error_print ("Error while loading '%s': %s\n",
-		       MANIFEST_FILENAME, zip_error_strerror (&zerror));
-	  zip_error_fini (&zerror);
+	  error_print ("Cannot read element %d. Continuing...\n", i);
 	  ret = -1;
 	  continue;
 	}
 
-      g_byte_array_set_size (wave, zstat.size);
-      zip_file = zip_fopen (pkg->zip, sample_path, 0);
-      zip_fread (zip_file, wave->data, zstat.size);
-      wave->len = zstat.size;
-      zip_fclose (zip_file);
+      if (job->known)
+	{
+	  existing_path = elektron_get_sample_path_from_hash_size (backend,
+								   job->hash,
+								   job->size);
+	  if (existing_path)
+	    {
+	      debug_print (1, "Sample %s already in %s. Skipping...\n",
+			   job->path, existing_path);
+	      g_free (existing_path);
+	      package_free_sample_job (job);
+	      continue;
+	    }
+	}
+
+      g_ptr_array_add (jobs, job);
+    }
+
+  pool = g_thread_pool_new (package_decode_sample, NULL,
+			    g_get_num_processors (), FALSE, NULL);
+
+  control->parts = jobs->len + 1;
+  control->part = 1;
+  set_job_control_progress (control, 0.0);
+  next = 0;
+  for (i = 0; i < jobs->len; i++, control->part++)
+    {
+      //Decoding of the following samples runs while the current one is sent.
+      for (; next < jobs->len && next <= i + PKG_DECODE_AHEAD; next++)
+	{
+	  job = g_ptr_array_index (jobs, next);
+	  job->wave = g_byte_array_new ();
+	  if (package_read_file (pkg, job->path, job->wave))
+	    {
+	      job->err = -1;
+	      job->done = TRUE;
+	      continue;
+	    }
+	  g_thread_pool_push (pool, job, NULL);
+	}
 
-      raw->len = 0;
-      if (sample_load_from_array (wave, raw, control,
-				  &ELEKTRON_SAMPLE_PARAMS, &frames))
+      job = g_ptr_array_index (jobs, i);
+      g_mutex_lock (&job->mutex);
+      while (!job->done)
 	{
-	  error_print ("Error while loading '%s': %s\n",
-		       sample_path, zip_error_strerror (&zerror));
-	  continue;
+	  g_cond_wait (&job->cond, &job->mutex);
 	}
+      g_mutex_unlock (&job->mutex);
 
-      pkg_resource = g_malloc (sizeof (struct package_resource));
-      pkg_resource->type = PKG_RES_TYPE_SAMPLE;
-      pkg_resource->data = g_byte_array_sized_new (raw->len);
-      pkg_resource->data->len = raw->len;
-      memcpy (pkg_resource->data->data, raw->data, raw->len);
-      pkg_resource->path = strdup (sample_path);
+      g_mutex_lock (&control->mutex);
+      active = control->active;
+      g_mutex_unlock (&control->mutex);
+      if (!active)
+	{
+	  break;
+	}
 
-      pkg->resources = g_list_append (pkg->resources, pkg_resource);
+      //The first error is the one returned.
+      if (job->err)
+	{
+	  error_print ("Error while loading '%s'\n", job->path);
+	  ret = ret ? ret : -1;
+	  continue;
+	}
 
       //We remove the "Samples" at the beggining of the full zip path.
-      ret = upload_sample (backend, &sample_path[7], pkg_resource->data,
-			   control);
+      control->data = job->control.data;
+      job->control.data = NULL;
+      err = upload_sample (backend, &job->path[7], job->raw, control);
       g_free (control->data);
       control->data = NULL;
-      if (ret)
+      g_byte_array_free (job->raw, TRUE);
+      job->raw = NULL;
+      if (err)
 	{
 	  error_print ("Error while uploading sample to '%s'\n",
-		       &sample_path[7]);
+		       &job->path[7]);
+	  ret = ret ? ret : err;
 	  continue;
 	}
     }
 
-  g_byte_array_free (wave, TRUE);
-  g_byte_array_free (raw, TRUE);
+  for (i = 0; i < jobs->len; i++)
+    {
+      job = g_ptr_array_index (jobs, i);
+      g_mutex_lock (&job->control.mutex);
+      job->control.active = FALSE;
+      g_mutex_unlock (&job->control.mutex);
+    }
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_ptr_array_free (jobs, TRUE);
 
 cleanup_reader:
   g_object_unref (reader);
@@ -28,6 +28,8 @@
 #define ELEKTRON_SAMPLE_RATE 48000
 #define ELEKTRON_SAMPLE_CHANNELS 1
 
+#define PKG_MAX_COMPRESSION_LEVEL 9
+
 enum package_resource_type
 {
   PKG_RES_TYPE_NONE,
@@ -59,7 +61,10 @@ struct package
   enum package_type type;
   gchar *fw_version;
   const struct device_desc *device_desc;
-  gchar *buff;
+  gchar *tmp_dir;
+  guint spooled;
+  gint compression_level;
+  GMappedFile *mapped_file;
   zip_source_t *zip_source;
   zip_t *zip;
   GList *resources;
@@ -73,11 +78,11 @@ gint package_receive_pkg_resources (struct package *, const gchar *,
 				    struct job_control *, struct backend *,
 				    fs_remote_file_op, fs_remote_file_op);
 
-gint package_end (struct package *, GByteArray *);
+gint package_end (struct package *, struct job_control *);
 
 void package_destroy (struct package *);
 
-gint package_open (struct package *, GByteArray *,
+gint package_open (struct package *, const gchar *,
 		   const struct device_desc *);
 
 gint package_send_pkg_resources (struct package *,
@@ -88,6 +93,18 @@ gint package_send_pkg_resources (struct package *,
 
 void package_close (struct package *);
 
+gint package_load (const gchar *, GByteArray *, struct job_control *);
+
+gint package_save (const gchar *, GByteArray *, struct job_control *);
+
+gchar *package_take_path (struct job_control *);
+
+void package_discard (struct job_control *);
+
+void package_set_compression_level (gint);
+
+gint package_get_compression_level ();
+
 extern const struct sample_params ELEKTRON_SAMPLE_PARAMS;
 
 #endif
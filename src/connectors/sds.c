@@ -24,11 +24,11 @@
 #include "elektron.h"
 #include "sample.h"
 #include "sds.h"
+#include "sds_codec.h"
 #include "common.h"
 
 #define SDS_SAMPLE_LIMIT 1000
 #define SDS_DATA_PACKET_LEN 127
-#define SDS_DATA_PACKET_PAYLOAD_LEN 120
 #define SDS_DATA_PACKET_CKSUM_POS 125
 #define SDS_DATA_PACKET_CKSUM_START 1
 #define SDS_BYTES_PER_WORD 3
@@ -38,14 +38,58 @@
 #define SDS_NO_SPEC_TIMEOUT 5000	//Timeout used when the specs indicate to wait indefinitely.
 #define SDS_NO_SPEC_TIMEOUT_TRY 1500	//Timeout for SDS extensions that might not be implemented.
 #define SDS_REST_TIME_DEFAULT 18000	//Rest time to not overwhelm the devices whn sending consecutive packets. Lower values cause an an E-Mu ESI-2000 to send corrupted packets.
-#define SDS_NO_SPEC_OPEN_LOOP_REST_TIME 200000
+#define SDS_NO_SPEC_OPEN_LOOP_REST_TIME 200000	//Time given to the device to process the dump before checking it.
+#define SDS_MIDI_BAUD_RATE 31250
+#define SDS_MIDI_BITS_PER_BYTE 10	//Start bit, 8 data bits and stop bit.
+#define SDS_REST_TIME_MIN 1000
+#define SDS_REST_TIME_MAX (SDS_REST_TIME_DEFAULT * 4)
+#define SDS_CALIBRATION_CLEAN_PACKETS 32	//Consecutive good packets needed to shorten the rest time.
+#define SDS_SCAN_TIMEOUT 200	//Timeout for dump requests while scanning the slots.
 #define SDS_SAMPLE_CHANNELS 1
 #define SDS_SAMPLE_NAME_MAX_LEN 127
+#define SDS_RTT_DATA 0		//Request type for the timeout estimation of the data packets
+#define SDS_RTT_ACK 1		//Request type for the timeout estimation of the ACKs
+
+enum sds_slot_state
+{
+  SDS_SLOT_UNKNOWN = 0,
+  SDS_SLOT_EMPTY,
+  SDS_SLOT_USED
+};
+
+struct sds_slot
+{
+  enum sds_slot_state state;
+  guint words;
+  guint bits;
+  guint samplerate;
+  guint loopstart;
+  guint loopend;
+  guint looptype;
+};
 
 struct sds_data
 {
-  gint rest_time;
   gboolean name_extension;
+  gchar device_id[LABEL_MAX];
+  guint clean_packets;
+  gint64 min_latency;
+  gboolean rest_time_updated;
+  gboolean usb;
+  gint open_loop_margin;
+  gboolean range;
+  //Slot scan. The transfer mutex keeps the scan requests out of the transfers.
+  GRecMutex transfer_mutex;
+  GMutex scan_mutex;
+  GThread *scan_thread;
+  gboolean scanning;
+  struct sds_slot slots[SDS_SAMPLE_LIMIT];
+};
+
+struct sds_iterator_data
+{
+  guint next;
+  struct sds_data *sds_data;
 };
 
 static const guint8 SDS_SAMPLE_REQUEST[] = { 0xf0, 0x7e, 0, 0x3, 0, 0, 0xf7 };
@@ -61,6 +105,85 @@ static const guint8 SDS_SAMPLE_NAME_HEADER[] =
 static const guint8 SDS_DUMP_HEADER[] =
   { 0xf0, 0x7e, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xf7 };
 
+//The rest time between packets is learnt per device and stored in the backend
+//profile. It starts from the profile value, or the default, and is shortened
+//by an eighth after every SDS_CALIBRATION_CLEAN_PACKETS good packets. A NAK or
+//a bad checksum doubles it.
+//ACKs that take more than twice the fastest one plus SDS_SPEC_TIMEOUT are taken
+//as a device under stress and do not count as good packets.
+
+static void
+sds_calibration_save (struct backend *backend)
+{
+  struct sds_data *sds_data = backend->data;
+
+  //Ranges store it only once at the end.
+  if (!sds_data->rest_time_updated || sds_data->range)
+    {
+      return;
+    }
+
+  backend_save_profile (backend);
+  sds_data->rest_time_updated = FALSE;
+}
+
+static void
+sds_calibration_start (struct sds_data *sds_data)
+{
+  //Ranges keep learning across their items.
+  if (sds_data->range)
+    {
+      return;
+    }
+
+  sds_data->clean_packets = 0;
+  sds_data->min_latency = G_MAXINT64;
+}
+
+static void
+sds_calibration_update (struct backend *backend, gboolean ok,
+			gint64 latency)
+{
+  struct sds_data *sds_data = backend->data;
+  gint rest_time = backend->profile.rest_time;
+
+  if (!ok)
+    {
+      sds_data->clean_packets = 0;
+      rest_time = CLAMP (rest_time * 2, SDS_REST_TIME_MIN, SDS_REST_TIME_MAX);
+    }
+  else
+    {
+      if (latency < sds_data->min_latency)
+	{
+	  sds_data->min_latency = latency;
+	}
+
+      if (latency > sds_data->min_latency * 2 + SDS_SPEC_TIMEOUT * 1000)
+	{
+	  sds_data->clean_packets = 0;
+	  return;
+	}
+
+      sds_data->clean_packets++;
+      if (sds_data->clean_packets < SDS_CALIBRATION_CLEAN_PACKETS)
+	{
+	  return;
+	}
+
+      sds_data->clean_packets = 0;
+      rest_time = MAX (rest_time - rest_time / 8, SDS_REST_TIME_MIN);
+    }
+
+  if (rest_time != backend->profile.rest_time)
+    {
+      debug_print (1, "Rest time changed from %d us to %d us\n",
+		   backend->profile.rest_time, rest_time);
+      backend->profile.rest_time = rest_time;
+      sds_data->rest_time_updated = TRUE;
+    }
+}
+
 static gchar *
 sds_get_download_path (struct backend *backend,
 		       struct item_iterator *remote_iter,
@@ -77,6 +200,7 @@ sds_get_download_path (struct backend *backend,
 
   if (sds_data->name_extension)
     {
+      g_rec_mutex_lock (&sds_data->transfer_mutex);
       g_mutex_lock (&backend->mutex);
       backend_rx_drain (backend);
       g_mutex_unlock (&backend->mutex);
@@ -87,6 +211,7 @@ sds_get_download_path (struct backend *backend,
       tx_msg->data[5] = index % 0x80;
       tx_msg->data[6] = index / 0x80;
       rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, SDS_NO_SPEC_TIMEOUT);
+      g_rec_mutex_unlock (&sds_data->transfer_mutex);
       if (rx_msg)
 	{
 	  snprintf (name, PATH_MAX, "%s/%s.wav", dst_dir, &rx_msg->data[5]);
@@ -125,33 +250,6 @@ sds_set_bytes_value_right_just (guint8 * data, gint length, guint value)
     }
 }
 
-static gint16
-sds_get_gint16_value_left_just (guint8 * data, gint length, guint bits)
-{
-  guint value = 0;
-  gint16 svalue;
-  for (gint i = length - 1, shift = 0; i >= 0; i--, shift += 7)
-    {
-      value |= (((guint) data[i]) << shift);
-    }
-  value >>= length * 7 - bits;
-  svalue = (gint16) (value - 0x8000);
-  return svalue;
-}
-
-static void
-sds_set_gint16_value_left_just (guint8 * data, gint length, guint bits,
-				gint16 svalue)
-{
-  gint value = svalue;
-  value += (guint) 0x8000;
-  value <<= length * 7 - bits;
-  for (gint i = length - 1, shift = 0; i >= 0; i--, shift += 7)
-    {
-      data[i] = (guint8) (0x7f & (value >> shift));
-    }
-}
-
 static guint8
 sds_checksum (guint8 * data)
 {
@@ -324,40 +422,105 @@ sds_debug_print_sample_data (guint bitdepth, guint bytes_per_word,
   debug_print (1, "Packets: %d\n", packets);
 }
 
-static GByteArray *
-sds_download_get_header (struct backend *backend, guint id)
+static gboolean
+sds_is_nak (GByteArray * rx_msg)
+{
+  return rx_msg->len == sizeof (SDS_NAK) && rx_msg->data[1] == SDS_NAK[1]
+    && rx_msg->data[3] == SDS_NAK[3];
+}
+
+static gboolean
+sds_is_dump_header (GByteArray * rx_msg, guint id)
+{
+  return rx_msg->len == sizeof (SDS_DUMP_HEADER)
+    && !memcmp (rx_msg->data, SDS_DUMP_HEADER, 4)
+    && sds_check_message_id (rx_msg, id);
+}
+
+static enum sds_slot_state
+sds_get_slot_state (struct sds_data *sds_data, guint id)
+{
+  enum sds_slot_state state;
+  g_mutex_lock (&sds_data->scan_mutex);
+  state = sds_data->slots[id].state;
+  g_mutex_unlock (&sds_data->scan_mutex);
+  return state;
+}
+
+static void
+sds_set_slot (struct sds_data *sds_data, guint id, guint words, guint bits,
+	      struct sample_info *sample_info)
+{
+  struct sds_slot *slot;
+
+  if (id >= SDS_SAMPLE_LIMIT)
+    {
+      return;
+    }
+
+  g_mutex_lock (&sds_data->scan_mutex);
+  slot = &sds_data->slots[id];
+  slot->state = words ? SDS_SLOT_USED : SDS_SLOT_EMPTY;
+  slot->words = words;
+  slot->bits = bits;
+  if (sample_info)
+    {
+      slot->samplerate = sample_info->samplerate;
+      slot->loopstart = sample_info->loopstart;
+      slot->loopend = sample_info->loopend;
+      slot->looptype = sample_info->looptype;
+    }
+  g_mutex_unlock (&sds_data->scan_mutex);
+}
+
+//A device answers a dump request for an empty slot with a NAK, so only then
+//-ENOENT is returned. A timeout or any other message is just an error.
+static gint
+sds_download_get_header (struct backend *backend, guint id, gint timeout,
+			 GByteArray ** header)
 {
   GByteArray *tx_msg, *rx_msg;
 
   tx_msg = sds_get_request_msg (id);
-  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, SDS_NO_SPEC_TIMEOUT);
+  rx_msg = backend_tx_and_rx_sysex (backend, tx_msg, timeout);
+  if (!rx_msg)
+    {
+      debug_print (1, "No dump header\n");
+      return -ETIMEDOUT;
+    }
 
-  if (rx_msg && rx_msg->len == sizeof (SDS_DUMP_HEADER)
-      && !memcmp (rx_msg->data, SDS_DUMP_HEADER, 4)
-      && sds_check_message_id (rx_msg, id))
+  if (sds_is_dump_header (rx_msg, id))
     {
-      return rx_msg;
+      *header = rx_msg;
+      return 0;
     }
 
-  debug_print (1, "Bad dump header\n");
+  if (sds_is_nak (rx_msg))
+    {
+      debug_print (1, "Slot %d is empty\n", id);
+      free_msg (rx_msg);
+      return -ENOENT;
+    }
 
-  return NULL;
+  debug_print (1, "Bad dump header\n");
+  free_msg (rx_msg);
+  return -EIO;
 }
 
 static gint
 sds_download_try (struct backend *backend, const gchar * path,
 		  GByteArray * output, struct job_control *control)
 {
-  guint id, words, word_size, read_bytes, bytes_per_word, total_words, err,
+  guint id, words, word_size, bytes_per_word, total_words = 0, err, n,
     retries, packets, packet, exp_packet, rx_packets;
-  gint16 sample;
   GByteArray *tx_msg, *rx_msg;
   gchar *path_copy, *index;
-  guint8 *dataptr;
-  gboolean active, first;
+  gboolean active, first, adaptive;
   gboolean last_packet_ack;
+  gint64 start;
   struct sample_info *sample_info;
   struct sysex_transfer transfer;
+  struct sds_word_codec codec;
   struct sds_data *sds_data = backend->data;
 
   path_copy = strdup (path);
@@ -372,14 +535,19 @@ sds_download_try (struct backend *backend, const gchar * path,
   backend_rx_drain (backend);
   g_mutex_unlock (&backend->mutex);
 
-  rx_msg = sds_download_get_header (backend, id);
-  if (!rx_msg)
+  err = sds_download_get_header (backend, id, SDS_NO_SPEC_TIMEOUT, &rx_msg);
+  if (err)
     {
+      if (err == -ENOENT)
+	{
+	  sds_set_slot (sds_data, id, 0, 0, NULL);
+	  return err;
+	}
       err = -EIO;
       goto end;
     }
 
-  usleep (sds_data->rest_time);
+  usleep (backend->profile.rest_time);
 
   sample_info = malloc (sizeof (struct sample_info));
   if (sds_get_download_info (rx_msg, sample_info, &words, &word_size,
@@ -391,8 +559,8 @@ sds_download_try (struct backend *backend, const gchar * path,
       goto end;
     }
 
-  packets =
-    ceil (words / (double) (SDS_DATA_PACKET_PAYLOAD_LEN / bytes_per_word));
+  sds_get_word_codec (&codec, sample_info->bitdepth);
+  packets = ceil (words / (double) codec.words_per_packet);
   sds_debug_print_sample_data (sample_info->bitdepth, bytes_per_word,
 			       word_size, sample_info->samplerate, words,
 			       packets);
@@ -407,6 +575,8 @@ sds_download_try (struct backend *backend, const gchar * path,
 
   debug_print (1, "Receiving dump data...\n");
 
+  g_byte_array_set_size (output, words * sizeof (gint16));
+  sds_calibration_start (sds_data);
   tx_msg = g_byte_array_new ();
   total_words = 0;
   retries = 0;
@@ -420,6 +590,7 @@ sds_download_try (struct backend *backend, const gchar * path,
       if (retries == SDS_MAX_RETRIES)
 	{
 	  debug_print (1, "Too many retries\n");
+	  err = -EIO;
 	  break;
 	}
 
@@ -441,14 +612,29 @@ sds_download_try (struct backend *backend, const gchar * path,
 	}
       else
 	{
+	  //The first packet might take longer and the last retry is always done with the ceiling.
+	  adaptive = !first && retries < SDS_MAX_RETRIES - 1;
 	  transfer.raw = tx_msg;
-	  transfer.timeout = SDS_NO_SPEC_TIMEOUT;
+	  transfer.timeout = adaptive ?
+	    backend_get_timeout (backend, SDS_RTT_DATA,
+				 SDS_NO_SPEC_TIMEOUT) : SDS_NO_SPEC_TIMEOUT;
+	  start = g_get_monotonic_time ();
 	  err = backend_tx_and_rx_sysex_transfer (backend, &transfer, FALSE);
 	  if (err == -ECANCELED)
 	    {
 	      break;
 	    }
 	  rx_msg = transfer.raw;
+
+	  if (!rx_msg && adaptive)
+	    {
+	      backend_update_rtt (backend, SDS_RTT_DATA, -1);
+	    }
+	  else if (rx_msg && adaptive && !retries)
+	    {
+	      backend_update_rtt (backend, SDS_RTT_DATA,
+				  g_get_monotonic_time () - start);
+	    }
 	}
 
       if (!rx_msg)
@@ -465,7 +651,14 @@ sds_download_try (struct backend *backend, const gchar * path,
 	      err = 0;
 	      goto end;
 	    }
-	  err = (rx_packets == packets - 1) ? -EBADMSG : -EINVAL;
+	  if (rx_packets < packets - 1)
+	    {
+	      //The last handshake might have been lost so it is sent again.
+	      debug_print (2, "Resending last handshake...\n");
+	      retries++;
+	      continue;
+	    }
+	  err = -EBADMSG;
 	  sds_download_inc_packet (&first, &packet);
 	  break;
 	}
@@ -479,7 +672,16 @@ sds_download_try (struct backend *backend, const gchar * path,
 	}
 
       guint exp_packet_id = exp_packet % 0x80;
-      if (rx_msg->data[4] != exp_packet_id)
+      if (exp_packet && last_packet_ack
+	  && rx_msg->data[4] == (exp_packet - 1) % 0x80)
+	{
+	  //The device did not get the ACK and sent the previous packet again.
+	  debug_print (2, "Repeated packet received. Acknowledging again...\n");
+	  free_msg (rx_msg);
+	  retries++;
+	  continue;
+	}
+      else if (rx_msg->data[4] != exp_packet_id)
 	{
 	  debug_print (2, "Invalid packet number. Stopping...\n");
 	  free_msg (rx_msg);
@@ -497,8 +699,9 @@ sds_download_try (struct backend *backend, const gchar * path,
 	{
 	  debug_print (2, "Invalid cksum. Retrying...\n");
 	  free_msg (rx_msg);
+	  sds_calibration_update (backend, FALSE, 0);
 	  last_packet_ack = FALSE;
-	  usleep (sds_data->rest_time);
+	  usleep (backend->profile.rest_time);
 	  retries++;
 	  continue;
 	}
@@ -506,21 +709,16 @@ sds_download_try (struct backend *backend, const gchar * path,
       exp_packet++;
       rx_packets++;
 
+      //Packets are paced by the sender so only errors are meaningful here.
+      sds_calibration_update (backend, TRUE, 0);
       last_packet_ack = TRUE;
       retries = 0;
 
-      read_bytes = 0;
-      dataptr = &rx_msg->data[5];
-      while (read_bytes < SDS_DATA_PACKET_PAYLOAD_LEN && total_words < words)
-	{
-	  sample = sds_get_gint16_value_left_just (dataptr,
-						   bytes_per_word,
-						   sample_info->bitdepth);
-	  g_byte_array_append (output, (guint8 *) & sample, sizeof (sample));
-	  dataptr += bytes_per_word;
-	  read_bytes += bytes_per_word;
-	  total_words++;
-	}
+      n = MIN (codec.words_per_packet, words - total_words);
+      codec.unpack (((gint16 *) output->data) + total_words,
+		    &rx_msg->data[sizeof (SDS_DATA_PACKET_HEADER)], n,
+		    codec.bits);
+      total_words += n;
 
       set_job_control_progress (control, rx_packets / (double) packets);
 
@@ -530,32 +728,190 @@ sds_download_try (struct backend *backend, const gchar * path,
 
       free_msg (rx_msg);
 
-      usleep (sds_data->rest_time);
+      usleep (backend->profile.rest_time);
     }
 
   free_msg (tx_msg);
 
 end:
+  g_byte_array_set_size (output, total_words * sizeof (gint16));
+
   if (active && !err && rx_packets == packets)
     {
       debug_print (1, "%d frames received\n", total_words);
       set_job_control_progress (control, 1.0);
+      sds_calibration_save (backend);
     }
   else
     {
       debug_print (1, "Cancelling SDS download...\n");
-      usleep (sds_data->rest_time);
+      usleep (backend->profile.rest_time);
       sds_tx_handshake (backend, SDS_CANCEL, packet % 0x80);
     }
 
   return err;
 }
 
+static void
+sds_scan_slot (struct backend *backend, guint id)
+{
+  gint err;
+  GByteArray *rx_msg;
+  struct sample_info sample_info;
+  guint words, bits;
+  struct sds_data *sds_data = backend->data;
+
+  g_mutex_lock (&backend->mutex);
+  backend_rx_drain (backend);
+  g_mutex_unlock (&backend->mutex);
+
+  //Only a NAK marks a slot as empty. After a timeout or an unexpected
+  //message, the slot stays unknown.
+  err = sds_download_get_header (backend, id, SDS_SCAN_TIMEOUT, &rx_msg);
+  if (err)
+    {
+      if (err == -ENOENT)
+	{
+	  sds_set_slot (sds_data, id, 0, 0, NULL);
+	}
+      usleep (backend->profile.rest_time);
+      return;
+    }
+
+  bits = rx_msg->data[6];
+  words = sds_get_bytes_value_right_just (&rx_msg->data[10],
+					  SDS_BYTES_PER_WORD);
+  sample_info.samplerate =
+    1.0e9 / sds_get_bytes_value_right_just (&rx_msg->data[7],
+					    SDS_BYTES_PER_WORD);
+  sample_info.loopstart =
+    sds_get_bytes_value_right_just (&rx_msg->data[13], SDS_BYTES_PER_WORD);
+  sample_info.loopend =
+    sds_get_bytes_value_right_just (&rx_msg->data[16], SDS_BYTES_PER_WORD);
+  sample_info.looptype = rx_msg->data[19];
+  sds_set_slot (sds_data, id, words, bits, &sample_info);
+  debug_print (2, "Slot %d: %d words; %d bits; %d Hz\n", id, words,
+	       bits, sample_info.samplerate);
+
+  //The device is waiting for an ACK to start the dump.
+  usleep (backend->profile.rest_time);
+  sds_tx_handshake (backend, SDS_CANCEL, 0);
+
+  free_msg (rx_msg);
+  usleep (backend->profile.rest_time);
+}
+
+//The scan only requests the dump headers and cancels the dumps so the sizes are
+//known without downloading anything. Transfers have priority as the scan
+//releases the device after every slot.
+static gpointer
+sds_scan_thread (gpointer data)
+{
+  guint used = 0;
+  gboolean scanning;
+  enum sds_slot_state state;
+  struct backend *backend = data;
+  struct sds_data *sds_data = backend->data;
+
+  debug_print (1, "Scanning slots...\n");
+
+  for (guint id = 0; id < SDS_SAMPLE_LIMIT; id++)
+    {
+      g_mutex_lock (&sds_data->scan_mutex);
+      scanning = sds_data->scanning;
+      state = sds_data->slots[id].state;
+      g_mutex_unlock (&sds_data->scan_mutex);
+
+      if (!scanning)
+	{
+	  debug_print (1, "Slot scan stopped\n");
+	  return NULL;
+	}
+
+      //Slots already written during the scan are known.
+      if (state == SDS_SLOT_UNKNOWN)
+	{
+	  g_rec_mutex_lock (&sds_data->transfer_mutex);
+	  sds_scan_slot (backend, id);
+	  g_rec_mutex_unlock (&sds_data->transfer_mutex);
+	}
+
+      if (sds_get_slot_state (sds_data, id) == SDS_SLOT_USED)
+	{
+	  used++;
+	}
+    }
+
+  //If no slot is used, the device probably ignores dump requests.
+  if (!used)
+    {
+      debug_print (1, "No samples found. Discarding scan...\n");
+      g_mutex_lock (&sds_data->scan_mutex);
+      memset (sds_data->slots, 0, sizeof (sds_data->slots));
+      g_mutex_unlock (&sds_data->scan_mutex);
+    }
+
+  debug_print (1, "Slot scan finished (%d samples)\n", used);
+
+  return NULL;
+}
+
+static gint sds_scan = FALSE;
+
+void
+sds_set_scan (gboolean scan)
+{
+  debug_print (1, "Setting slot scan to %s...\n", scan ? "on" : "off");
+  g_atomic_int_set (&sds_scan, scan);
+}
+
+gboolean
+sds_get_scan ()
+{
+  return g_atomic_int_get (&sds_scan);
+}
+
+static void
+sds_start_scan (struct backend *backend)
+{
+  struct sds_data *sds_data = backend->data;
+
+  sds_data->scanning = sds_get_scan ();
+  if (sds_data->scanning)
+    {
+      sds_data->scan_thread = g_thread_new ("sds_scan", sds_scan_thread,
+					    backend);
+    }
+}
+
+static void
+sds_destroy_data (struct backend *backend)
+{
+  struct sds_data *sds_data = backend->data;
+
+  if (sds_data->scan_thread)
+    {
+      g_mutex_lock (&sds_data->scan_mutex);
+      sds_data->scanning = FALSE;
+      g_mutex_unlock (&sds_data->scan_mutex);
+      g_thread_join (sds_data->scan_thread);
+    }
+
+  g_mutex_clear (&sds_data->scan_mutex);
+  g_rec_mutex_clear (&sds_data->transfer_mutex);
+  backend_destroy_data (backend);
+}
+
 static gint
 sds_download (struct backend *backend, const gchar * path,
 	      GByteArray * output, struct job_control *control)
 {
   gint err;
+  struct sds_data *sds_data = backend->data;
+
+  //Even if the scan found the slot empty, the device is always asked as the
+  //scan might be outdated.
+  g_rec_mutex_lock (&sds_data->transfer_mutex);
   for (gint i = 0; i < SDS_MAX_RETRIES; i++)
     {
       err = sds_download_try (backend, path, output, control);
@@ -570,12 +926,17 @@ sds_download (struct backend *backend, const gchar * path,
 	  break;
 	}
     }
+  g_rec_mutex_unlock (&sds_data->transfer_mutex);
   return err;
 }
 
+//If not NULL, rx_packet is set to the packet number of the last handshake
+//message received, which might not be the one sent if the device got out of
+//sync.
 static gint
 sds_tx_and_wait_ack (struct backend *backend, GByteArray * tx_msg,
-		     guint packet, gint timeout, gint timeout2)
+		     guint packet, gint timeout, gint timeout2,
+		     guint * rx_packet_num)
 {
   gint err;
   gint t;
@@ -593,6 +954,10 @@ sds_tx_and_wait_ack (struct backend *backend, GByteArray * tx_msg,
     {
       rx_packet = rx_msg->data[4];
       rx_msg->data[4] = 0;
+      if (rx_packet_num)
+	{
+	  *rx_packet_num = rx_packet;
+	}
 
       if (!memcmp (rx_msg->data, SDS_WAIT, sizeof (SDS_WAIT)) && !waiting)
 	{
@@ -639,10 +1004,9 @@ sds_tx_and_wait_ack (struct backend *backend, GByteArray * tx_msg,
 }
 
 static inline GByteArray *
-sds_get_data_packet_msg (gint packet, guint words, guint * word,
-			 gint16 ** frame, guint bits, guint bytes_per_word)
+sds_get_data_packet_msg (gint packet, const gint16 * frames, guint n,
+			 const struct sds_word_codec *codec)
 {
-  guint8 *data;
   GByteArray *tx_msg = g_byte_array_sized_new (SDS_DATA_PACKET_LEN);
   g_byte_array_append (tx_msg, SDS_DATA_PACKET_HEADER,
 		       sizeof (SDS_DATA_PACKET_HEADER));
@@ -651,18 +1015,8 @@ sds_get_data_packet_msg (gint packet, guint words, guint * word,
   memset (&tx_msg->data[sizeof (SDS_DATA_PACKET_HEADER)], 0,
 	  SDS_DATA_PACKET_PAYLOAD_LEN);
   tx_msg->data[SDS_DATA_PACKET_LEN - 1] = 0xf7;
-  data = &tx_msg->data[sizeof (SDS_DATA_PACKET_HEADER)];
-  for (guint i = 0; i < SDS_DATA_PACKET_PAYLOAD_LEN; i += bytes_per_word)
-    {
-      if (*word < words)
-	{
-	  sds_set_gint16_value_left_just (data, bytes_per_word, bits,
-					  **frame);
-	  data += bytes_per_word;
-	  (*frame)++;
-	  (*word)++;
-	}
-    }
+  codec->pack (&tx_msg->data[sizeof (SDS_DATA_PACKET_HEADER)], frames, n,
+	       codec->bits);
   tx_msg->data[SDS_DATA_PACKET_CKSUM_POS] = sds_checksum (tx_msg->data);
   return tx_msg;
 }
@@ -690,6 +1044,7 @@ sds_rename (struct backend *backend, const gchar * src, const gchar * dst)
   guint id;
   gint err;
   gchar *name, *dstcpy;
+  struct sds_data *sds_data = backend->data;
   debug_print (1, "Sending rename request...\n");
   err = common_slot_get_id_name_from_path (src, &id, NULL);
   if (err)
@@ -697,6 +1052,8 @@ sds_rename (struct backend *backend, const gchar * src, const gchar * dst)
       return err;
     }
 
+  g_rec_mutex_lock (&sds_data->transfer_mutex);
+
   g_mutex_lock (&backend->mutex);
   backend_rx_drain (backend);
   g_mutex_unlock (&backend->mutex);
@@ -712,21 +1069,128 @@ sds_rename (struct backend *backend, const gchar * src, const gchar * dst)
       free_msg (rx_msg);
     }
 
+  g_rec_mutex_unlock (&sds_data->transfer_mutex);
+
   g_free (dstcpy);
   return err;
 }
 
+//Packet numbers are sent modulo 128 so the packet the device refers to is the
+//closest one not after the current one. If the device acknowledged it, the
+//transfer resumes from the next one; if not, from that very one.
+static gint
+sds_get_resync_packet (guint packet, guint rx_packet, gboolean ack)
+{
+  guint behind = ((packet % 0x80) - rx_packet) & 0x7f;
+
+  if (behind > packet)
+    {
+      return -1;
+    }
+
+  return packet - behind + (ack ? 1 : 0);
+}
+
+static gint sds_open_loop_margin = SDS_OPEN_LOOP_MARGIN_DEFAULT;
+
+void
+sds_set_open_loop_margin (gint margin)
+{
+  if (margin < 0)
+    {
+      error_print ("Invalid open loop margin %d. Using default...\n",
+		   margin);
+      margin = SDS_OPEN_LOOP_MARGIN_DEFAULT;
+    }
+  debug_print (1, "Setting open loop margin to %d %%...\n", margin);
+  g_atomic_int_set (&sds_open_loop_margin, margin);
+}
+
+gint
+sds_get_open_loop_margin ()
+{
+  return g_atomic_int_get (&sds_open_loop_margin);
+}
+
+//Without ACKs, packets are paced at the DIN wire rate plus the margin.
+//Over a hardware UART the synchronous write only returns once the bytes are on
+//the wire so that time is discounted. USB interfaces return as soon as the
+//data is queued so nothing can be assumed about it.
+static void
+sds_open_loop_wait (struct sds_data *sds_data, gint64 elapsed)
+{
+  gint64 wait = SDS_DATA_PACKET_LEN * SDS_MIDI_BITS_PER_BYTE * 1000000LL /
+    SDS_MIDI_BAUD_RATE;
+  wait += wait * sds_data->open_loop_margin / 100;
+
+  if (!sds_data->usb)
+    {
+      wait -= elapsed;
+    }
+
+  if (wait > 0)
+    {
+      usleep (wait);
+    }
+}
+
+//As there is no feedback in open loop, the dump header is requested back to
+//check that the device accepted the sample.
+static gint
+sds_upload_confirm (struct backend *backend, guint id, guint words,
+		    guint bits)
+{
+  gint err = 0;
+  guint rx_words;
+  GByteArray *rx_msg;
+
+  debug_print (1, "Confirming open loop upload...\n");
+
+  usleep (SDS_NO_SPEC_OPEN_LOOP_REST_TIME);
+
+  g_mutex_lock (&backend->mutex);
+  backend_rx_drain (backend);
+  g_mutex_unlock (&backend->mutex);
+
+  err = sds_download_get_header (backend, id, SDS_NO_SPEC_TIMEOUT, &rx_msg);
+  if (err == -ENOENT)
+    {
+      error_print ("Sample not accepted by device (empty slot)\n");
+      return -EIO;
+    }
+  else if (err)
+    {
+      debug_print (1, "Device does not answer dump requests. Unconfirmed.\n");
+      return 0;
+    }
+
+  rx_words = sds_get_bytes_value_right_just (&rx_msg->data[10],
+					     SDS_BYTES_PER_WORD);
+  if (rx_msg->data[6] != bits || rx_words != words)
+    {
+      error_print ("Sample not accepted by device (%d bits, %d words)\n",
+		   rx_msg->data[6], rx_words);
+      err = -EIO;
+    }
+  free_msg (rx_msg);
+
+  sds_tx_handshake (backend, SDS_CANCEL, 0);
+  usleep (SDS_REST_TIME_DEFAULT);
+
+  return err;
+}
+
 static gint
 sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
 	    struct job_control *control, guint bits)
 {
   gchar *name;
   GByteArray *tx_msg;
-  gint16 *frame, *f;
-  gboolean active, open_loop = FALSE;
-  guint word, words, words_per_packet, id, packet = 0, packets, retries =
-    0, w, bytes_per_word;
-  gint err = 0, word_size;
+  gboolean active, open_loop = FALSE, adaptive;
+  guint word, words, id, packet = 0, packets, retries = 0, rx_packet;
+  gint err = 0, word_size, resync, timeout, late_timeout = 0;
+  struct sds_word_codec codec;
+  gint64 start, transfer_start;
   struct sds_data *sds_data = backend->data;
   struct sample_info *sample_info = control->data;
 
@@ -739,6 +1203,8 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
       return -EBADSLT;
     }
 
+  g_rec_mutex_lock (&sds_data->transfer_mutex);
+
   g_mutex_lock (&backend->mutex);
   backend_rx_drain (backend);
   g_mutex_unlock (&backend->mutex);
@@ -751,14 +1217,13 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
 
   words = input->len >> 1;	//bytes to words (frames)
   word_size = (gint) ceil (bits / 8.0);
-  bytes_per_word = (gint) ceil (bits / 7.0);
-  words_per_packet = SDS_DATA_PACKET_PAYLOAD_LEN / bytes_per_word;
-  packets = ceil (words / (double) words_per_packet);
+  sds_get_word_codec (&codec, bits);
+  packets = ceil (words / (double) codec.words_per_packet);
 
   tx_msg = sds_get_dump_msg (id, words, sample_info, bits);
   //The first timeout should be SDS_SPEC_TIMEOUT_HANDSHAKE (2 s) buit it is not enough sometimes.
   err = sds_tx_and_wait_ack (backend, tx_msg, 0, SDS_NO_SPEC_TIMEOUT,
-			     SDS_NO_SPEC_TIMEOUT);
+			     SDS_NO_SPEC_TIMEOUT, NULL);
   if (err == -ENOMSG)
     {
       debug_print (2, "No packet received after a WAIT. Continuing...\n");
@@ -776,11 +1241,11 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
 
   debug_print (1, "Sending dump data...\n");
 
-  word = 0;
-  sds_debug_print_sample_data (bits, bytes_per_word,
+  sds_debug_print_sample_data (bits, codec.bytes_per_word,
 			       word_size, sample_info->samplerate, words,
 			       packets);
-  frame = (gint16 *) input->data;
+  sds_calibration_start (sds_data);
+  transfer_start = g_get_monotonic_time ();
   while (packet < packets && active)
     {
       if (retries == SDS_MAX_RETRIES)
@@ -789,27 +1254,81 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
 	  break;
 	}
 
-      f = frame;
-      w = word;
-      tx_msg = sds_get_data_packet_msg (packet % 0x80, words, &w, &f, bits,
-					bytes_per_word);
+      //As every packet has the same amount of words, any packet can be resent.
+      word = packet * codec.words_per_packet;
+      tx_msg = sds_get_data_packet_msg (packet % 0x80,
+					((gint16 *) input->data) + word,
+					MIN (codec.words_per_packet,
+					     words - word), &codec);
       if (open_loop)
 	{
+	  start = g_get_monotonic_time ();
 	  err = sds_tx (backend, tx_msg);
-	  usleep (SDS_NO_SPEC_OPEN_LOOP_REST_TIME);
+	  sds_open_loop_wait (sds_data, g_get_monotonic_time () - start);
 	}
       else
 	{
-	  //SDS_SPEC_TIMEOUT is too low to be used here.
+	  //SDS_SPEC_TIMEOUT is too low to be used here so the estimated timeout is used for the first try and
+	  //SDS_NO_SPEC_TIMEOUT for the retry.
+	  adaptive = packet && !retries;
+	  timeout = adaptive ? backend_get_timeout (backend, SDS_RTT_ACK,
+						    SDS_NO_SPEC_TIMEOUT) :
+	    SDS_NO_SPEC_TIMEOUT;
+	  start = g_get_monotonic_time ();
 	  err = sds_tx_and_wait_ack (backend, tx_msg, packet % 0x80,
-				     SDS_NO_SPEC_TIMEOUT,
-				     SDS_NO_SPEC_TIMEOUT);
+				     timeout, SDS_NO_SPEC_TIMEOUT,
+				     &rx_packet);
+	  if (err == -ETIMEDOUT && adaptive && timeout < SDS_NO_SPEC_TIMEOUT)
+	    {
+	      backend_update_rtt (backend, SDS_RTT_ACK, -1);
+	      late_timeout = timeout;
+	    }
+	  if (!err || err == -EBADMSG)
+	    {
+	      if (adaptive)
+		{
+		  backend_update_rtt (backend, SDS_RTT_ACK,
+				      g_get_monotonic_time () - start);
+		}
+	      else if (late_timeout)
+		{
+		  //The ACK of the first try might have been just late so a second one is discarded.
+		  GByteArray *rx_msg = sds_rx (backend, late_timeout);
+		  if (rx_msg)
+		    {
+		      debug_print (2, "Discarding duplicated ACK...\n");
+		      free_msg (rx_msg);
+		    }
+		}
+	      late_timeout = 0;
+
+	      sds_calibration_update (backend, !err,
+				      g_get_monotonic_time () - start);
+
+	      if (rx_packet != packet % 0x80)
+		{
+		  //An ACK for an older packet means that the following one was lost.
+		  resync = sds_get_resync_packet (packet, rx_packet, !err);
+		  if (resync < 0)
+		    {
+		      debug_print (2, "Unexpected packet number. Stopping...\n");
+		      err = -EINVAL;
+		      goto end;
+		    }
+		  debug_print (2, "Resuming from packet %d...\n", resync);
+		  packet = resync;
+		  retries++;
+		  usleep (backend->profile.rest_time);
+		  continue;
+		}
+	    }
 	}
 
       if (err == -EBADMSG)
 	{
 	  debug_print (2, "NAK received. Retrying...\n");
 	  retries++;
+	  usleep (backend->profile.rest_time);
 	  continue;
 	}
       else if (err == -ENOMSG)
@@ -824,6 +1343,12 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
 	  debug_print (2, "Unexpectd packet number. Continuing...\n");
 	  goto end;
 	}
+      else if (err == -ETIMEDOUT && packet && !retries)
+	{
+	  debug_print (2, "No response. Retrying...\n");
+	  retries++;
+	  continue;
+	}
       else if (err == -ETIMEDOUT)
 	{
 	  debug_print (2, "No response. Continuing in open loop...\n");
@@ -846,13 +1371,30 @@ sds_upload (struct backend *backend, const gchar * path, GByteArray * input,
       active = control->active;
       g_mutex_unlock (&control->mutex);
 
-      word = w;
-      frame = f;
       packet++;
       retries = 0;
       err = 0;
 
-      usleep (sds_data->rest_time);
+      if (!open_loop)
+	{
+	  usleep (backend->profile.rest_time);
+	}
+    }
+
+  if (packet == packets)
+    {
+      debug_print (1, "%d B sent in %.1f s\n",
+		   packets * SDS_DATA_PACKET_LEN,
+		   (g_get_monotonic_time () - transfer_start) / 1.0e6);
+    }
+
+  if (active && packet == packets && open_loop)
+    {
+      err = sds_upload_confirm (backend, id, words, bits);
+      if (err)
+	{
+	  goto cleanup;
+	}
     }
 
   if (active && sds_data->name_extension)
@@ -864,6 +1406,11 @@ end:
   if (active && packet == packets)
     {
       set_job_control_progress (control, 1.0);
+      if (!open_loop)
+	{
+	  sds_calibration_save (backend);
+	}
+      sds_set_slot (sds_data, id, words, bits, sample_info);
     }
   else
     {
@@ -873,6 +1420,7 @@ end:
     }
 
 cleanup:
+  g_rec_mutex_unlock (&sds_data->transfer_mutex);
   g_free (name);
   return err;
 }
@@ -905,6 +1453,73 @@ sds_upload_16b (struct backend *backend, const gchar * path,
   return sds_upload (backend, path, input, control, 16);
 }
 
+//Ranges are transferred while holding the transfer mutex so the slot scan can not get in between the items.
+static gint
+sds_run_range (struct backend *backend, GPtrArray * paths,
+	       fs_remote_file_op op, gboolean upload, fs_range_item_func item,
+	       struct job_control *control, void *data)
+{
+  gint err;
+  struct sds_data *sds_data = backend->data;
+
+  g_rec_mutex_lock (&sds_data->transfer_mutex);
+  sds_calibration_start (sds_data);
+  sds_data->range = TRUE;
+
+  err = backend_run_range (backend, paths, op, upload, item, control, data);
+
+  sds_data->range = FALSE;
+  sds_calibration_save (backend);
+  g_rec_mutex_unlock (&sds_data->transfer_mutex);
+
+  return err;
+}
+
+static gint
+sds_download_range (struct backend *backend, GPtrArray * paths,
+		    fs_range_item_func item, struct job_control *control,
+		    void *data)
+{
+  return sds_run_range (backend, paths, sds_download, FALSE, item, control,
+			data);
+}
+
+static gint
+sds_upload_range_8b (struct backend *backend, GPtrArray * paths,
+		     fs_range_item_func item, struct job_control *control,
+		     void *data)
+{
+  return sds_run_range (backend, paths, sds_upload_8b, TRUE, item, control,
+			data);
+}
+
+static gint
+sds_upload_range_12b (struct backend *backend, GPtrArray * paths,
+		      fs_range_item_func item, struct job_control *control,
+		      void *data)
+{
+  return sds_run_range (backend, paths, sds_upload_12b, TRUE, item, control,
+			data);
+}
+
+static gint
+sds_upload_range_14b (struct backend *backend, GPtrArray * paths,
+		      fs_range_item_func item, struct job_control *control,
+		      void *data)
+{
+  return sds_run_range (backend, paths, sds_upload_14b, TRUE, item, control,
+			data);
+}
+
+static gint
+sds_upload_range_16b (struct backend *backend, GPtrArray * paths,
+		      fs_range_item_func item, struct job_control *control,
+		      void *data)
+{
+  return sds_run_range (backend, paths, sds_upload_16b, TRUE, item, control,
+			data);
+}
+
 static void
 sds_free_iterator_data (void *iter_data)
 {
@@ -915,14 +1530,28 @@ sds_free_iterator_data (void *iter_data)
 static guint
 sds_next_dentry (struct item_iterator *iter)
 {
-  gint next = *((gint *) iter->data);
-  if (next < SDS_SAMPLE_LIMIT)
+  struct sds_iterator_data *data = iter->data;
+  struct sds_slot slot;
+
+  if (data->next < SDS_SAMPLE_LIMIT)
     {
-      iter->item.id = next;
-      snprintf (iter->item.name, LABEL_MAX, "%03d", next);
+      g_mutex_lock (&data->sds_data->scan_mutex);
+      slot = data->sds_data->slots[data->next];
+      g_mutex_unlock (&data->sds_data->scan_mutex);
+
+      iter->item.id = data->next;
+      snprintf (iter->item.name, LABEL_MAX, "%03d", data->next);
       iter->item.type = ELEKTROID_FILE;
-      iter->item.size = -1;
-      (*((gint *) iter->data))++;
+      //Slots not scanned yet have an unknown size.
+      if (slot.state == SDS_SLOT_UNKNOWN)
+	{
+	  iter->item.size = -1;
+	}
+      else
+	{
+	  iter->item.size = slot.words * sizeof (gint16);
+	}
+      data->next++;
       return 0;
     }
   else
@@ -935,28 +1564,81 @@ static gint
 sds_read_dir (struct backend *backend, struct item_iterator *iter,
 	      const gchar * path)
 {
+  struct sds_iterator_data *data;
+
   if (strcmp (path, "/"))
     {
       return -ENOTDIR;
     }
 
-  iter->data = g_malloc (sizeof (guint));
-  *((gint *) iter->data) = 0;
+  data = g_malloc (sizeof (struct sds_iterator_data));
+  data->next = 0;
+  data->sds_data = backend->data;
+  iter->data = data;
   iter->next = sds_next_dentry;
   iter->free = sds_free_iterator_data;
   return 0;
 }
 
-gint
+//Samples are loaded with the resolution of the filesystem so that what is
+//played or converted is what the device stores. Frames are still 16 bits.
+
+static gint
 sds_sample_load (const gchar * path, GByteArray * sample,
-		 struct job_control *control)
+		 struct job_control *control, guint bits)
 {
+  gint err;
   guint frames;
+  gint16 *frame, mask;
   struct sample_params sample_params;
   sample_params.samplerate = 0;	// Any sample rate is valid.
   sample_params.channels = SDS_SAMPLE_CHANNELS;
-  return sample_load_from_file (path, sample, control, &sample_params,
-				&frames);
+  sample_params.quality = SAMPLE_QUALITY_DEFAULT;
+  sample_params.trim = TRUE;
+  err = sample_load_from_file (path, sample, control, &sample_params,
+			       &frames);
+  if (err || bits >= 16)
+    {
+      return err;
+    }
+
+  //This keeps the same bits sds_pack_words keeps.
+  mask = (gint16) (0xffff << (16 - bits));
+  frame = (gint16 *) sample->data;
+  for (guint i = 0; i < sample->len / sizeof (gint16); i++, frame++)
+    {
+      *frame &= mask;
+    }
+
+  return 0;
+}
+
+static gint
+sds_sample_load_8b (const gchar * path, GByteArray * sample,
+		    struct job_control *control)
+{
+  return sds_sample_load (path, sample, control, 8);
+}
+
+static gint
+sds_sample_load_12b (const gchar * path, GByteArray * sample,
+		     struct job_control *control)
+{
+  return sds_sample_load (path, sample, control, 12);
+}
+
+static gint
+sds_sample_load_14b (const gchar * path, GByteArray * sample,
+		     struct job_control *control)
+{
+  return sds_sample_load (path, sample, control, 14);
+}
+
+static gint
+sds_sample_load_16b (const gchar * path, GByteArray * sample,
+		     struct job_control *control)
+{
+  return sds_sample_load (path, sample, control, 16);
 }
 
 static void
@@ -987,8 +1669,10 @@ static const struct fs_operations FS_SAMPLES_SDS_8B_OPERATIONS = {
   .rename = sds_rename,
   .download = sds_download,
   .upload = sds_upload_8b,
+  .download_range = sds_download_range,
+  .upload_range = sds_upload_range_8b,
   .get_id = get_item_index,
-  .load = sds_sample_load,
+  .load = sds_sample_load_8b,
   .save = sample_save_from_array,
   .get_ext = backend_get_fs_ext,
   .get_upload_path = common_slot_get_upload_path,
@@ -1009,8 +1693,10 @@ static const struct fs_operations FS_SAMPLES_SDS_12B_OPERATIONS = {
   .rename = sds_rename,
   .download = sds_download,
   .upload = sds_upload_12b,
+  .download_range = sds_download_range,
+  .upload_range = sds_upload_range_12b,
   .get_id = get_item_index,
-  .load = sds_sample_load,
+  .load = sds_sample_load_12b,
   .save = sample_save_from_array,
   .get_ext = backend_get_fs_ext,
   .get_upload_path = common_slot_get_upload_path,
@@ -1031,8 +1717,10 @@ static const struct fs_operations FS_SAMPLES_SDS_14B_OPERATIONS = {
   .rename = sds_rename,
   .download = sds_download,
   .upload = sds_upload_14b,
+  .download_range = sds_download_range,
+  .upload_range = sds_upload_range_14b,
   .get_id = get_item_index,
-  .load = sds_sample_load,
+  .load = sds_sample_load_14b,
   .save = sample_save_from_array,
   .get_ext = backend_get_fs_ext,
   .get_upload_path = common_slot_get_upload_path,
@@ -1053,15 +1741,17 @@ static const struct fs_operations FS_SAMPLES_SDS_16B_OPERATIONS = {
   .rename = sds_rename,
   .download = sds_download,
   .upload = sds_upload_16b,
+  .download_range = sds_download_range,
+  .upload_range = sds_upload_range_16b,
   .get_id = get_item_index,
-  .load = sds_sample_load,
+  .load = sds_sample_load_16b,
   .save = sample_save_from_array,
   .get_ext = backend_get_fs_ext,
   .get_upload_path = common_slot_get_upload_path,
   .get_download_path = sds_get_download_path
 };
 
-static const struct fs_operations *FS_SDS_ALL_OPERATIONS[] = {
+const struct fs_operations *FS_SDS_ALL_OPERATIONS[] = {
   &FS_SAMPLES_SDS_8B_OPERATIONS, &FS_SAMPLES_SDS_12B_OPERATIONS,
   &FS_SAMPLES_SDS_14B_OPERATIONS, &FS_SAMPLES_SDS_16B_OPERATIONS, NULL
 };
@@ -1071,7 +1761,7 @@ sds_handshake (struct backend *backend)
 {
   gint err;
   GByteArray *tx_msg, *rx_msg;
-  struct sds_data *sds_data = g_malloc (sizeof (struct sds_data));
+  struct sds_data *sds_data = g_malloc0 (sizeof (struct sds_data));
 
   //Elektron devices support SDS so we need to be sure it is not.
   rx_msg = elektron_ping (backend);
@@ -1091,7 +1781,7 @@ sds_handshake (struct backend *backend)
   tx_msg = sds_get_dump_msg (1000, 0, NULL, 16);
   //In case we receive anything, there is a MIDI SDS device listening.
   err = sds_tx_and_wait_ack (backend, tx_msg, 0, SDS_SPEC_TIMEOUT_HANDSHAKE,
-			     SDS_NO_SPEC_TIMEOUT_TRY);
+			     SDS_NO_SPEC_TIMEOUT_TRY, NULL);
   if (err == -EIO || err == -ETIMEDOUT || err == -ENOMSG)
     {
       return -ENODEV;
@@ -1122,14 +1812,26 @@ sds_handshake (struct backend *backend)
 
   //The remaining code is meant to set up different devices. These are the default values.
 
-  sds_data->rest_time = SDS_REST_TIME_DEFAULT;
+  snprintf (sds_data->device_id, LABEL_MAX, "%s",
+	    strlen (backend->device_name) ? backend->device_name : "default");
+  sds_data->rest_time_updated = FALSE;
+  backend->profile.rest_time = SDS_REST_TIME_DEFAULT;
+  backend->profile.block_len = SDS_DATA_PACKET_LEN;	//Fixed by the specs. Only used to calibrate.
+  backend_load_profile (backend, sds_data->device_id);
+  backend->profile.rest_time = CLAMP (backend->profile.rest_time,
+				      SDS_REST_TIME_MIN, SDS_REST_TIME_MAX);
+  sds_data->usb = backend_is_usb (backend);
+  sds_data->open_loop_margin = sds_get_open_loop_margin ();
 
   backend->device_desc.filesystems =
     FS_SAMPLES_SDS_8_B | FS_SAMPLES_SDS_12_B | FS_SAMPLES_SDS_14_B |
     FS_SAMPLES_SDS_16_B;
   backend->fs_ops = FS_SDS_ALL_OPERATIONS;
-  backend->destroy_data = backend_destroy_data;
+  g_rec_mutex_init (&sds_data->transfer_mutex);
+  g_mutex_init (&sds_data->scan_mutex);
+  backend->destroy_data = sds_destroy_data;
   backend->data = sds_data;
+  sds_start_scan (backend);
 
   if (strlen (backend->device_name))
     {
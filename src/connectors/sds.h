@@ -23,6 +23,18 @@
 
 #include "backend.h"
 
+#define SDS_OPEN_LOOP_MARGIN_DEFAULT 100	//Percentage of the wire time added to every packet in open loop.
+
+extern const struct fs_operations *FS_SDS_ALL_OPERATIONS[];
+
 gint sds_handshake (struct backend *);
 
+void sds_set_open_loop_margin (gint);
+
+gint sds_get_open_loop_margin ();
+
+void sds_set_scan (gboolean);
+
+gboolean sds_get_scan ();
+
 #endif
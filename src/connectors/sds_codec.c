@@ -0,0 +1,136 @@
+/*
+ *   sds_codec.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Elektroid.
+ *
+ *   Elektroid is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Elektroid is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Elektroid. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sds_codec.h"
+
+//Words are left justified in 2 or 3 bytes of 7 bits. Frames are always 16 bits
+//so the resolution of the transfer is only kept in the most significant bits.
+//As these are called with constant arguments from the kernels below, the
+//compiler generates a specialized loop for every resolution.
+
+static inline void
+sds_pack_words (guint8 * data, const gint16 * frames, guint n, guint bits,
+		guint bytes_per_word)
+{
+  guint value;
+  for (guint i = 0; i < n; i++, data += bytes_per_word)
+    {
+      value = ((guint) (frames[i] + 0x8000)) >> (16 - bits);
+      value <<= bytes_per_word * 7 - bits;
+      if (bytes_per_word == 3)
+	{
+	  data[0] = 0x7f & (value >> 14);
+	  data[1] = 0x7f & (value >> 7);
+	  data[2] = 0x7f & value;
+	}
+      else
+	{
+	  data[0] = 0x7f & (value >> 7);
+	  data[1] = 0x7f & value;
+	}
+    }
+}
+
+static inline void
+sds_unpack_words (gint16 * frames, const guint8 * data, guint n, guint bits,
+		  guint bytes_per_word)
+{
+  guint value;
+  for (guint i = 0; i < n; i++, data += bytes_per_word)
+    {
+      if (bytes_per_word == 3)
+	{
+	  value = (data[0] << 14) | (data[1] << 7) | data[2];
+	}
+      else
+	{
+	  value = (data[0] << 7) | data[1];
+	}
+      value >>= bytes_per_word * 7 - bits;
+      value <<= 16 - bits;
+      frames[i] = (gint16) (value - 0x8000);
+    }
+}
+
+#define SDS_WORD_CODEC(b, bpw) \
+static void \
+sds_pack_words_##b (guint8 * data, const gint16 * frames, guint n, \
+		    guint bits) \
+{ \
+  sds_pack_words (data, frames, n, b, bpw); \
+} \
+\
+static void \
+sds_unpack_words_##b (gint16 * frames, const guint8 * data, guint n, \
+		      guint bits) \
+{ \
+  sds_unpack_words (frames, data, n, b, bpw); \
+}
+
+SDS_WORD_CODEC (8, 2)
+SDS_WORD_CODEC (12, 2)
+SDS_WORD_CODEC (14, 2)
+SDS_WORD_CODEC (16, 3)
+
+static void
+sds_pack_words_any (guint8 * data, const gint16 * frames, guint n,
+		    guint bits)
+{
+  sds_pack_words (data, frames, n, bits, bits < 15 ? 2 : 3);
+}
+
+static void
+sds_unpack_words_any (gint16 * frames, const guint8 * data, guint n,
+		      guint bits)
+{
+  sds_unpack_words (frames, data, n, bits, bits < 15 ? 2 : 3);
+}
+
+void
+sds_get_word_codec (struct sds_word_codec *codec, guint bits)
+{
+  codec->bits = bits;
+  codec->bytes_per_word = bits < 15 ? 2 : 3;
+  codec->words_per_packet =
+    SDS_DATA_PACKET_PAYLOAD_LEN / codec->bytes_per_word;
+
+  switch (bits)
+    {
+    case 8:
+      codec->pack = sds_pack_words_8;
+      codec->unpack = sds_unpack_words_8;
+      break;
+    case 12:
+      codec->pack = sds_pack_words_12;
+      codec->unpack = sds_unpack_words_12;
+      break;
+    case 14:
+      codec->pack = sds_pack_words_14;
+      codec->unpack = sds_unpack_words_14;
+      break;
+    case 16:
+      codec->pack = sds_pack_words_16;
+      codec->unpack = sds_unpack_words_16;
+      break;
+    default:
+      codec->pack = sds_pack_words_any;
+      codec->unpack = sds_unpack_words_any;
+    }
+}
@@ -0,0 +1,43 @@
+/*
+ *   sds_codec.h
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Elektroid.
+ *
+ *   Elektroid is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Elektroid is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Elektroid. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SDS_CODEC_H
+#define SDS_CODEC_H
+
+#include <glib.h>
+
+#define SDS_DATA_PACKET_PAYLOAD_LEN 120
+
+typedef void (*sds_pack_words_t) (guint8 *, const gint16 *, guint, guint);
+
+typedef void (*sds_unpack_words_t) (gint16 *, const guint8 *, guint, guint);
+
+struct sds_word_codec
+{
+  guint bits;
+  guint bytes_per_word;
+  guint words_per_packet;
+  sds_pack_words_t pack;
+  sds_unpack_words_t unpack;
+};
+
+void sds_get_word_codec (struct sds_word_codec *, guint);
+
+#endif
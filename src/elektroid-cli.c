@@ -30,6 +30,10 @@
 #include "backend.h"
 #include "connector.h"
 #include "utils.h"
+#include "sample.h"
+#include "connectors/package.h"
+#include "connectors/sds.h"
+#include "connectors/elektron.h"
 
 #define GET_FS_OPS_OFFSET(member) offsetof(struct fs_operations, member)
 #define GET_FS_OPS_FUNC(type,fs,offset) (*(((type *) (((gchar *) fs) + offset))))
@@ -332,6 +336,250 @@ cli_info (int argc, gchar * argv[], int *optind)
   return EXIT_SUCCESS;
 }
 
+static int
+cli_calibrate (int argc, gchar * argv[], int *optind)
+{
+  gint err;
+  gint64 rtt;
+  gchar *device_path;
+
+  if (*optind == argc)
+    {
+      error_print ("Device missing\n");
+      return EXIT_FAILURE;
+    }
+  else
+    {
+      device_path = argv[*optind];
+      (*optind)++;
+    }
+
+  if (cli_connect (device_path))
+    {
+      return EXIT_FAILURE;
+    }
+
+  err = backend_calibrate (&backend, &rtt);
+  if (err)
+    {
+      return EXIT_FAILURE;
+    }
+
+  err = backend_save_profile (&backend);
+  if (err)
+    {
+      error_print ("Error while saving profile: %s\n", g_strerror (-err));
+      return EXIT_FAILURE;
+    }
+
+  printf ("%s; tx_len=%d B; rest_time=%d us; block_len=%d B; timeout=%d ms; rtt=%.2f ms\n",
+	  backend.device_name, backend.profile.tx_len,
+	  backend.profile.rest_time, backend.profile.block_len,
+	  backend.profile.timeout, rtt / 1000.0);
+
+  return EXIT_SUCCESS;
+}
+
+struct cli_convert_task
+{
+  gchar *src_path;
+  gchar *dst_path;
+};
+
+static gint convert_errors;
+
+static gboolean
+cli_is_active ()
+{
+  gboolean active;
+  g_mutex_lock (&control.mutex);
+  active = control.active;
+  g_mutex_unlock (&control.mutex);
+  return active;
+}
+
+static void
+cli_convert_file (gpointer data, gpointer user_data)
+{
+  gint err;
+  GByteArray *sample;
+  struct job_control task_control;
+  struct cli_convert_task *task = data;
+  const struct fs_operations *ops = user_data;
+
+  if (!cli_is_active ())
+    {
+      g_atomic_int_inc (&convert_errors);
+      goto end;
+    }
+
+  task_control.active = TRUE;
+  task_control.callback = NULL;
+  task_control.parts = 1;
+  task_control.part = 0;
+  task_control.data = NULL;
+  g_mutex_init (&task_control.mutex);
+
+  sample = g_byte_array_new ();
+  err = ops->load (task->src_path, sample, &task_control);
+  if (!err)
+    {
+      err = sample_save_from_array (task->dst_path, sample, &task_control);
+    }
+
+  if (err)
+    {
+      error_print ("Error while converting '%s': %s\n", task->src_path,
+		   g_strerror (-err));
+      g_atomic_int_inc (&convert_errors);
+    }
+  else
+    {
+      printf ("%s\n", task->dst_path);
+    }
+
+  g_free (task_control.data);
+  g_byte_array_free (sample, TRUE);
+  g_mutex_clear (&task_control.mutex);
+
+end:
+  g_free (task->src_path);
+  g_free (task->dst_path);
+  g_free (task);
+}
+
+// Every sample in the source tree is queued into the pool and written with
+// the same relative path into the destination tree. Samples that only differ
+// in the extension would be written to the same file so these are skipped.
+
+static gint
+cli_convert_dir (GThreadPool * pool, const gchar * src_dir,
+		 const gchar * dst_dir)
+{
+  GDir *dir;
+  gint err = 0;
+  const gchar *name;
+  gchar *src_path, *dst_path, *dst_name;
+  struct cli_convert_task *task;
+  GHashTable *dst_paths;
+  gchar **exts = (gchar **) sample_get_sample_extensions ();
+
+  dir = g_dir_open (src_dir, 0, NULL);
+  if (!dir)
+    {
+      error_print ("Error while opening directory '%s'\n", src_dir);
+      return -EIO;
+    }
+
+  if (g_mkdir_with_parents (dst_dir, S_IRWXU | S_IRGRP | S_IXGRP |
+			    S_IROTH | S_IXOTH))
+    {
+      error_print ("Error while creating directory '%s'\n", dst_dir);
+      g_dir_close (dir);
+      return -EIO;
+    }
+
+  dst_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  while (!err && (name = g_dir_read_name (dir)))
+    {
+      src_path = g_build_filename (src_dir, name, NULL);
+
+      if (g_file_test (src_path, G_FILE_TEST_IS_DIR))
+	{
+	  dst_path = g_build_filename (dst_dir, name, NULL);
+	  err = cli_convert_dir (pool, src_path, dst_path);
+	  g_free (dst_path);
+	  g_free (src_path);
+	}
+      else if (file_matches_extensions (name, exts))
+	{
+	  dst_name = g_strdup (name);
+	  remove_ext (dst_name);
+	  dst_path = g_strdup_printf ("%s/%s.wav", dst_dir, dst_name);
+	  g_free (dst_name);
+
+	  if (g_hash_table_contains (dst_paths, dst_path))
+	    {
+	      error_print ("'%s' and '%s' would be both converted to '%s'\n",
+			   (gchar *) g_hash_table_lookup (dst_paths, dst_path),
+			   src_path, dst_path);
+	      g_atomic_int_inc (&convert_errors);
+	      g_free (dst_path);
+	      g_free (src_path);
+	      continue;
+	    }
+	  g_hash_table_insert (dst_paths, g_strdup (dst_path),
+			       g_strdup (src_path));
+
+	  task = g_malloc (sizeof (struct cli_convert_task));
+	  task->src_path = src_path;
+	  task->dst_path = dst_path;
+	  g_thread_pool_push (pool, task, NULL);
+	}
+      else
+	{
+	  g_free (src_path);
+	}
+    }
+
+  g_hash_table_destroy (dst_paths);
+  g_dir_close (dir);
+
+  return err;
+}
+
+static int
+cli_convert (int argc, gchar * argv[], int *optind)
+{
+  gint err;
+  gchar *target, *aux;
+  const gchar *src_dir, *dst_dir;
+  const struct fs_operations *ops;
+  GThreadPool *pool;
+
+  if (argc - *optind < 3)
+    {
+      error_print ("Target, source or destination directory missing\n");
+      return EXIT_FAILURE;
+    }
+
+  target = g_strdup (argv[*optind]);
+  src_dir = argv[*optind + 1];
+  dst_dir = argv[*optind + 2];
+  *optind += 3;
+
+  aux = strchr (target, '-');
+  if (!aux)
+    {
+      error_print ("Invalid target '%s'\n", target);
+      g_free (target);
+      return EXIT_FAILURE;
+    }
+  *aux = 0;
+  aux++;
+
+  ops = connector_get_fs_operations (target, aux);
+  if (!ops || !(ops->options & FS_OPTION_AUDIO_PLAYER) || !ops->load)
+    {
+      error_print ("Invalid sample filesystem '%s' for connector '%s'\n",
+		   aux, target);
+      g_free (target);
+      return EXIT_FAILURE;
+    }
+  g_free (target);
+
+  control.active = TRUE;
+  convert_errors = 0;
+
+  pool = g_thread_pool_new (cli_convert_file, (gpointer) ops,
+			    g_get_num_processors (), TRUE, NULL);
+  err = cli_convert_dir (pool, src_dir, dst_dir);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  return err || convert_errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static int
 cli_df (int argc, gchar * argv[], int *optind)
 {
@@ -391,6 +639,12 @@ cli_df (int argc, gchar * argv[], int *optind)
   return res ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+static void
+cli_print_sysex_progress (struct sysex_transfer *transfer)
+{
+  fprintf (stderr, "\r%.1f %%", transfer->progress * 100.0);
+}
+
 static int
 cli_upgrade_os (int argc, gchar * argv[], int *optind)
 {
@@ -426,22 +680,94 @@ cli_upgrade_os (int argc, gchar * argv[], int *optind)
       return EXIT_FAILURE;
     }
 
-  sysex_transfer.raw = g_byte_array_new ();
-  res = load_file (src_path, sysex_transfer.raw, NULL);
+  CHECK_FS_OPS_FUNC (backend.upgrade_os);
+  sysex_transfer.active = TRUE;
+  sysex_transfer.status = SENDING;
+  sysex_transfer.timeout = BE_SYSEX_TIMEOUT_MS;
+  sysex_transfer.progress = 0.0;
+  sysex_transfer.callback = cli_print_sysex_progress;
+  g_mutex_init (&sysex_transfer.mutex);
+  res = backend.upgrade_os (&backend, src_path, &sysex_transfer);
+  fprintf (stderr, "\n");
   if (res)
     {
-      error_print ("Error while loading '%s'.\n", src_path);
+      error_print ("Error while upgrading from '%s': %s\n", src_path,
+		   g_strerror (-res));
     }
-  else
+  g_mutex_clear (&sysex_transfer.mutex);
+
+  return res ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//In slot storage filesystems, a name like "1-8" means all the slots from the first to the last one.
+static gboolean
+cli_get_range (const gchar * path, guint * first, guint * last)
+{
+  gint end = -1;
+  gchar *path_copy, *name;
+  gboolean range;
+
+  if (!(fs_ops->options & FS_OPTION_SLOT_STORAGE))
     {
-      sysex_transfer.active = TRUE;
-      sysex_transfer.timeout = BE_SYSEX_TIMEOUT_MS;
-      CHECK_FS_OPS_FUNC (backend.upgrade_os);
-      res = backend.upgrade_os (&backend, &sysex_transfer);
+      return FALSE;
     }
 
-  g_byte_array_free (sysex_transfer.raw, TRUE);
-  return res ? EXIT_FAILURE : EXIT_SUCCESS;
+  path_copy = strdup (path);
+  name = basename (path_copy);
+  range = sscanf (name, "%u-%u%n", first, last, &end) == 2
+    && end == strlen (name) && *first <= *last;
+  g_free (path_copy);
+
+  return range;
+}
+
+static gint
+cli_save_range_item (const gchar * path, guint index, GByteArray * array,
+		     struct job_control *control, void *data)
+{
+  GPtrArray *dst_paths = data;
+  return fs_ops->save (g_ptr_array_index (dst_paths, index), array, control);
+}
+
+static gint
+cli_load_range_item (const gchar * path, guint index, GByteArray * array,
+		     struct job_control *control, void *data)
+{
+  GPtrArray *src_paths = data;
+  return fs_ops->load (g_ptr_array_index (src_paths, index), array, control);
+}
+
+static gint
+cli_download_range (const gchar * src_path, guint first, guint last)
+{
+  gint res;
+  gchar *src_dirc, *src_dir;
+  gchar id[LABEL_MAX];
+  GPtrArray *paths, *dst_paths;
+
+  src_dirc = strdup (src_path);
+  src_dir = dirname (src_dirc);
+  paths = g_ptr_array_new_with_free_func (g_free);
+  dst_paths = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = first; i <= last; i++)
+    {
+      snprintf (id, LABEL_MAX, "%d", i);
+      g_ptr_array_add (paths, chain_path (src_dir, id));
+    }
+
+  res = backend_get_download_range_paths (&backend, fs_ops, paths, ".",
+					  dst_paths);
+  if (!res)
+    {
+      res = backend_download_range (&backend, fs_ops, paths,
+				    cli_save_range_item, &control, dst_paths);
+    }
+
+  g_ptr_array_free (paths, TRUE);
+  g_ptr_array_free (dst_paths, TRUE);
+  g_free (src_dirc);
+  return res;
 }
 
 static int
@@ -452,6 +778,7 @@ cli_download (int argc, gchar * argv[], int *optind)
   struct item_iterator iter;
   gchar *device_src_path, *download_path;
   gint res;
+  guint first, last;
   GByteArray *array;
 
   if (*optind == argc)
@@ -473,45 +800,100 @@ cli_download (int argc, gchar * argv[], int *optind)
   src_path = cli_get_path (device_src_path);
 
   control.active = TRUE;
-  array = g_byte_array_new ();
-  res = fs_ops->download (&backend, src_path, array, &control);
-  if (res)
+
+  if (cli_get_range (src_path, &first, &last))
     {
-      goto end;
+      res = cli_download_range (src_path, first, last);
+      return res ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
+  //The download path is set in advance so that nothing but saving can fail
+  //after downloading. Packages are left in a temporary file until then.
   src_dirc = strdup (src_path);
   src_dir = dirname (src_dirc);
   res = fs_ops->readdir (&backend, &iter, src_dir);
   g_free (src_dirc);
   if (res)
     {
-      goto end;
+      return EXIT_FAILURE;
     }
 
   download_path = fs_ops->get_download_path (&backend, &iter, fs_ops, ".",
 					     src_path);
+  free_item_iterator (&iter);
   if (!download_path)
     {
-      res = -1;
-      goto end;
+      return EXIT_FAILURE;
     }
 
-  res = fs_ops->save (download_path, array, &control);
-  g_free (download_path);
-  g_free (control.data);
+  array = g_byte_array_new ();
+  res = fs_ops->download (&backend, src_path, array, &control);
+  if (!res)
+    {
+      res = fs_ops->save (download_path, array, &control);
+      g_free (control.data);
+    }
 
-end:
+  g_free (download_path);
   g_byte_array_free (array, TRUE);
   return res ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
+//Every local file goes to the next slot in slot storage filesystems.
+static gint
+cli_upload_range (gchar ** src_paths, gint files, const gchar * dst_path)
+{
+  gint res, index = 1;
+  guint id;
+  gchar *dst_copy, *dst_dir, *name, *path;
+  GPtrArray *paths, *local_paths;
+
+  dst_copy = strdup (dst_path);
+  id = atoi (basename (dst_copy));
+  g_free (dst_copy);
+  dst_copy = strdup (dst_path);
+  dst_dir = dirname (dst_copy);
+
+  paths = g_ptr_array_new_with_free_func (g_free);
+  local_paths = g_ptr_array_new ();
+
+  for (gint i = 0; i < files; i++)
+    {
+      if (fs_ops->options & FS_OPTION_SLOT_STORAGE)
+	{
+	  name = strdup (src_paths[i]);
+	  remove_ext (name);
+	  path = g_malloc (PATH_MAX);
+	  snprintf (path, PATH_MAX, "%s%s%d%s%s", dst_dir,
+		    strcmp (dst_dir, "/") ? "/" : "", id + i,
+		    BE_SAMPLE_ID_NAME_SEPARATOR, basename (name));
+	  g_free (name);
+	}
+      else
+	{
+	  path = fs_ops->get_upload_path (&backend, NULL, fs_ops, dst_path,
+					  src_paths[i], &index);
+	}
+      g_ptr_array_add (paths, path);
+      g_ptr_array_add (local_paths, src_paths[i]);
+    }
+
+  res = backend_upload_range (&backend, fs_ops, paths, cli_load_range_item,
+			      &control, local_paths);
+
+  g_ptr_array_free (paths, TRUE);
+  g_ptr_array_free (local_paths, TRUE);
+  g_free (dst_copy);
+  return res;
+}
+
 static int
 cli_upload (int argc, gchar * argv[], int *optind)
 {
   const gchar *dst_dir;
   gchar *src_path, *device_dst_path, *upload_path;
-  gint res;
+  gchar **src_paths;
+  gint res, files;
   GByteArray *array;
   gint32 index = 1;
 
@@ -522,6 +904,7 @@ cli_upload (int argc, gchar * argv[], int *optind)
     }
   else
     {
+      src_paths = &argv[*optind];
       src_path = argv[*optind];
       (*optind)++;
     }
@@ -533,8 +916,10 @@ cli_upload (int argc, gchar * argv[], int *optind)
     }
   else
     {
-      device_dst_path = argv[*optind];
-      (*optind)++;
+      //Any argument before the last one is a local path.
+      files = argc - *optind;
+      device_dst_path = argv[argc - 1];
+      *optind = argc;
     }
 
   if (cli_connect (device_dst_path))
@@ -544,11 +929,18 @@ cli_upload (int argc, gchar * argv[], int *optind)
 
   dst_dir = cli_get_path (device_dst_path);
 
+  control.active = TRUE;
+
+  if (files > 1)
+    {
+      res = cli_upload_range (src_paths, files, dst_dir);
+      return res ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
   upload_path = fs_ops->get_upload_path (&backend, NULL, fs_ops, dst_dir,
 					 src_path, &index);
 
   array = g_byte_array_new ();
-  control.active = TRUE;
   res = fs_ops->load (src_path, array, &control);
   if (res)
     {
@@ -713,6 +1105,13 @@ main (int argc, gchar * argv[])
   gint res;
   gchar *command;
   gint vflg = 0, errflg = 0;
+  enum sample_quality quality;
+  gboolean trim = FALSE;
+  gdouble trim_threshold = SAMPLE_TRIM_DEFAULT_THRESHOLD;
+  gint trim_tail = SAMPLE_TRIM_DEFAULT_TAIL;
+  gint compression_level = 0;
+  gint open_loop_margin;
+  gint window;
   struct sigaction action;
 
   action.sa_handler = cli_end;
@@ -723,13 +1122,67 @@ main (int argc, gchar * argv[])
   sigaction (SIGINT, &action, NULL);
   sigaction (SIGHUP, &action, NULL);
 
-  while ((c = getopt (argc, argv, "v")) != -1)
+  while ((c = getopt (argc, argv, "m:q:st:T:vw:z:")) != -1)
     {
       switch (c)
 	{
+	case 'm':
+	  open_loop_margin = atoi (optarg);
+	  if (open_loop_margin < 0)
+	    {
+	      errflg++;
+	    }
+	  else
+	    {
+	      sds_set_open_loop_margin (open_loop_margin);
+	    }
+	  break;
+	case 'q':
+	  if (sample_parse_quality (optarg, &quality))
+	    {
+	      errflg++;
+	    }
+	  else
+	    {
+	      sample_set_quality (quality);
+	    }
+	  break;
+	case 's':
+	  sds_set_scan (TRUE);
+	  break;
+	case 't':
+	  trim = TRUE;
+	  trim_threshold = g_ascii_strtod (optarg, NULL);
+	  break;
+	case 'T':
+	  trim_tail = atoi (optarg);
+	  if (trim_tail < 0)
+	    {
+	      errflg++;
+	    }
+	  break;
 	case 'v':
 	  vflg++;
 	  break;
+	case 'w':
+	  window = atoi (optarg);
+	  if (window < 1 || window > OS_UPGRADE_WINDOW_MAX)
+	    {
+	      errflg++;
+	    }
+	  else
+	    {
+	      elektron_set_os_upgrade_window (window);
+	    }
+	  break;
+	case 'z':
+	  compression_level = atoi (optarg);
+	  if (compression_level < 0
+	      || compression_level > PKG_MAX_COMPRESSION_LEVEL)
+	    {
+	      errflg++;
+	    }
+	  break;
 	case '?':
 	  errflg++;
 	}
@@ -750,6 +1203,16 @@ main (int argc, gchar * argv[])
       debug_level = vflg;
     }
 
+  if (trim)
+    {
+      sample_set_trim (TRUE, trim_threshold, trim_tail);
+    }
+
+  if (compression_level)
+    {
+      package_set_compression_level (compression_level);
+    }
+
   if (errflg > 0)
     {
       fprintf (stderr, "%s\n", PACKAGE_STRING);
@@ -782,6 +1245,14 @@ main (int argc, gchar * argv[])
     {
       res = cli_upgrade_os (argc, argv, &optind);
     }
+  else if (!strcmp (command, "calibrate"))
+    {
+      res = cli_calibrate (argc, argv, &optind);
+    }
+  else if (!strcmp (command, "convert"))
+    {
+      res = cli_convert (argc, argv, &optind);
+    }
   else
     {
       if (set_conn_fs_op_from_command (command))
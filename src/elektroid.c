@@ -34,6 +34,9 @@
 #include "utils.h"
 #include "local.h"
 #include "preferences.h"
+#include "connectors/package.h"
+#include "connectors/sds.h"
+#include "connectors/elektron.h"
 
 #define PLAYER_VISIBLE (remote_browser.fs_ops->options & FS_OPTION_AUDIO_PLAYER ? TRUE : FALSE)
 #define PLAYER_PREF_CHANNELS (!remote_browser.fs_ops || (remote_browser.fs_ops->options & FS_OPTION_STEREO) || !preferences.mix ? 2 : 1)
@@ -67,6 +70,7 @@ enum task_list_store_columns
   TASK_LIST_STORE_TYPE_HUMAN_FIELD,
   TASK_LIST_STORE_REMOTE_FS_ID_FIELD,
   TASK_LIST_STORE_REMOTE_FS_ICON_FIELD,
+  TASK_LIST_STORE_SRC_PATHS_FIELD,
 };
 
 enum fs_list_store_columns
@@ -84,7 +88,8 @@ enum
 enum elektroid_task_type
 {
   UPLOAD,
-  DOWNLOAD
+  DOWNLOAD,
+  DOWNLOAD_RANGE
 };
 
 enum elektroid_task_status
@@ -100,13 +105,16 @@ struct elektroid_transfer
 {
   struct job_control control;
   gchar *src;			//Contains a path to a file
+  gchar **src_paths;		//Contains the paths to the files in range tasks
   gchar *dst;			//Contains a path to a file
   enum elektroid_task_status status;	//Contains the final status
   const struct fs_operations *fs_ops;	//Contains the fs_operations to use in this transfer
+  guint trimmed;		//Contains the bytes saved by the silence trimming
 };
 
 static gpointer elektroid_upload_task (gpointer);
 static gpointer elektroid_download_task (gpointer);
+static gpointer elektroid_download_range_task (gpointer);
 static void elektroid_update_progress (struct job_control *);
 static void elektroid_cancel_all_tasks (GtkWidget *, gpointer);
 static void elektroid_reset_sample (struct browser *);
@@ -686,13 +694,23 @@ elektroid_update_sysex_progress (gpointer data)
   gchar *text;
   gboolean active;
   enum sysex_transfer_status status;
-
-  gtk_progress_bar_pulse (GTK_PROGRESS_BAR (progress_bar));
+  gdouble progress;
 
   g_mutex_lock (&sysex_transfer.mutex);
   status = sysex_transfer.status;
+  progress = sysex_transfer.progress;
   g_mutex_unlock (&sysex_transfer.mutex);
 
+  if (progress > 0.0)
+    {
+      gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (progress_bar),
+				     progress);
+    }
+  else
+    {
+      gtk_progress_bar_pulse (GTK_PROGRESS_BAR (progress_bar));
+    }
+
   switch (status)
     {
     case WAITING:
@@ -902,15 +920,29 @@ elektroid_tx_upgrade_os_thread (gpointer data)
 {
   GSList *filenames = data;
   gint *err = malloc (sizeof (gint));
-  sysex_transfer.raw = g_byte_array_new ();
+
+  sysex_transfer.active = TRUE;
+  sysex_transfer.status = SENDING;
   sysex_transfer.timeout = BE_SYSEX_TIMEOUT_MS;
+  sysex_transfer.progress = 0.0;
+  sysex_transfer.callback = NULL;
 
   g_timeout_add (100, elektroid_update_sysex_progress, NULL);
 
-  *err = elektroid_send_sysex_file (filenames->data, backend.upgrade_os);
-  gtk_dialog_response (GTK_DIALOG (progress_dialog), GTK_RESPONSE_CANCEL);	//Any response is OK.
+  *err = backend.upgrade_os (&backend, filenames->data, &sysex_transfer);
+  if (*err && *err != -ECANCELED)
+    {
+      show_error_msg (_("Error while loading “%s”: %s."),
+		      (gchar *) filenames->data, g_strerror (-*err));
+    }
 
-  free_msg (sysex_transfer.raw);
+  g_mutex_lock (&sysex_transfer.mutex);
+  sysex_transfer.active = FALSE;
+  sysex_transfer.status = FINISHED;
+  sysex_transfer.progress = 0.0;
+  g_mutex_unlock (&sysex_transfer.mutex);
+
+  gtk_dialog_response (GTK_DIALOG (progress_dialog), GTK_RESPONSE_CANCEL);	//Any response is OK.
 
   return err;
 }
@@ -1051,11 +1083,13 @@ static gboolean
 elektroid_update_ui_on_load (gpointer data)
 {
   gboolean ready_to_play;
+  guint loaded;
   struct sample_info *sample_info = audio.control.data;
 
+  loaded = g_atomic_int_get (&audio.sample->len) >> PLAYER_LOADED_CHANNELS;
   g_mutex_lock (&audio.control.mutex);
-  ready_to_play = audio.frames >= LOAD_BUFFER_LEN || (!audio.control.active
-						      && audio.frames > 0);
+  ready_to_play = loaded >= LOAD_BUFFER_LEN || (!audio.control.active
+						&& loaded > 0);
   audio.channels = PLAYER_LOADED_CHANNELS;
   g_mutex_unlock (&audio.control.mutex);
 
@@ -1536,6 +1570,8 @@ elektroid_load_sample (gpointer data)
 
   sample_params.samplerate = AUDIO_SAMPLE_RATE;
   sample_params.channels = PLAYER_PREF_CHANNELS;
+  sample_params.quality = preferences.preview_quality;
+  sample_params.trim = FALSE;
 
   g_timeout_add (100, elektroid_update_ui_on_load, NULL);
 
@@ -1734,12 +1770,15 @@ elektroid_draw_waveform (GtkWidget * widget, cairo_t * cr, gpointer data)
   gint x_widget, x_sample;
   double x_ratio, mid_y1, mid_y2, value;
   short *sample;
+  guint len;
   double y_scale = 1.0 / (double) SHRT_MIN;
   double x_scale = 1.0 / (double) MAX_DRAW_X;
   struct sample_info *sample_info = audio.control.data;
   gboolean stereo = PLAYER_LOADED_CHANNELS == 2;
 
-  g_mutex_lock (&audio.control.mutex);
+  //The loader reserves the whole sample before publishing any length and the
+  //sample is only reset from this thread, so the lock is not needed.
+  len = g_atomic_int_get (&audio.sample->len);
 
   context = gtk_widget_get_style_context (widget);
   width = gtk_widget_get_allocated_width (widget) - 2;
@@ -1762,12 +1801,12 @@ elektroid_draw_waveform (GtkWidget * widget, cairo_t * cr, gpointer data)
   gdk_cairo_set_source_rgba (cr, &color);
 
   sample = (short *) audio.sample->data;
-  x_ratio = audio.frames / (double) MAX_DRAW_X;
-  for (gint i = 0; i < MAX_DRAW_X; i++)
+  x_ratio = g_atomic_int_get (&audio.frames) / (double) MAX_DRAW_X;
+  for (gint i = 0; i < MAX_DRAW_X && len; i++)
     {
       x_sample = i * x_ratio * (stereo ? 2 : 1);
       x_widget = i * width * x_scale;
-      if (x_sample < audio.sample->len >> 1)
+      if (x_sample < len >> 1)
 	{
 	  value = mid_y1 - sample[x_sample] * y_scale;
 	  cairo_move_to (cr, x_widget, mid_y1);
@@ -1783,8 +1822,6 @@ elektroid_draw_waveform (GtkWidget * widget, cairo_t * cr, gpointer data)
 	}
     }
 
-  g_mutex_unlock (&audio.control.mutex);
-
   return FALSE;
 }
 
@@ -2082,6 +2119,7 @@ elektroid_get_human_task_type (enum elektroid_task_type type)
     case UPLOAD:
       return _("Upload");
     case DOWNLOAD:
+    case DOWNLOAD_RANGE:
       return _("Download");
     default:
       return _("Undefined");
@@ -2225,7 +2263,22 @@ static gboolean
 elektroid_complete_running_task (gpointer data)
 {
   GtkTreeIter iter;
-  const gchar *status = elektroid_get_human_task_status (transfer.status);
+  gchar *hsize, *status;
+  const gchar *human_status =
+    elektroid_get_human_task_status (transfer.status);
+
+  if (transfer.status == COMPLETED_OK && transfer.trimmed)
+    {
+      hsize = get_human_size (transfer.trimmed, TRUE);
+      status = g_strdup_printf ("%s (%s %s)", human_status, hsize,
+				_("saved"));
+      g_free (hsize);
+    }
+  else
+    {
+      status = g_strdup (human_status);
+    }
+  transfer.trimmed = 0;
 
   if (elektroid_get_running_task (&iter))
     {
@@ -2236,6 +2289,8 @@ elektroid_complete_running_task (gpointer data)
       elektroid_stop_running_task (NULL, NULL);
       g_free (transfer.src);
       g_free (transfer.dst);
+      g_strfreev (transfer.src_paths);
+      transfer.src_paths = NULL;
 
       gtk_widget_set_sensitive (cancel_task_button, FALSE);
     }
@@ -2244,6 +2299,8 @@ elektroid_complete_running_task (gpointer data)
       debug_print (1, "No task running. Skipping...\n");
     }
 
+  g_free (status);
+
   return FALSE;
 }
 
@@ -2290,6 +2347,9 @@ elektroid_run_next_task (gpointer data)
       transfer.control.callback = elektroid_update_progress;
       transfer.src = src;
       transfer.dst = dst;
+      gtk_tree_model_get (GTK_TREE_MODEL (task_list_store), &iter,
+			  TASK_LIST_STORE_SRC_PATHS_FIELD,
+			  &transfer.src_paths, -1);
       transfer.fs_ops = backend_get_fs_operations (&backend, fs, NULL);
       debug_print (1, "Running task type %d from %s to %s (%s)...\n", type,
 		   transfer.src, transfer.dst, elektroid_get_fs_name (fs));
@@ -2304,6 +2364,12 @@ elektroid_run_next_task (gpointer data)
 	  task_thread =
 	    g_thread_new ("download_task", elektroid_download_task, NULL);
 	}
+      else if (type == DOWNLOAD_RANGE)
+	{
+	  task_thread =
+	    g_thread_new ("download_task", elektroid_download_range_task,
+			  NULL);
+	}
 
       gtk_widget_set_sensitive (cancel_task_button, TRUE);
     }
@@ -2353,6 +2419,13 @@ elektroid_upload_task (gpointer data)
       goto end_cleanup;
     }
 
+  if (transfer.fs_ops->options & FS_OPTION_AUDIO_PLAYER &&
+      transfer.control.data)
+    {
+      transfer.trimmed =
+	((struct sample_info *) transfer.control.data)->trimmed;
+    }
+
   debug_print (1, "Writing from file %s (filesystem %s)...\n", transfer.src,
 	       elektroid_get_fs_name (transfer.fs_ops->fs));
 
@@ -2399,8 +2472,9 @@ end_nodir:
 }
 
 static void
-elektroid_add_task (enum elektroid_task_type type, const char *src,
-		    const char *dst, gint remote_fs_id)
+elektroid_add_task_with_paths (enum elektroid_task_type type,
+			       const char *src, gchar ** src_paths,
+			       const char *dst, gint remote_fs_id)
 {
   const gchar *status_human = elektroid_get_human_task_status (QUEUED);
   const gchar *type_human = elektroid_get_human_task_type (type);
@@ -2420,11 +2494,19 @@ elektroid_add_task (enum elektroid_task_type type, const char *src,
 				     TASK_LIST_STORE_REMOTE_FS_ID_FIELD,
 				     remote_fs_id,
 				     TASK_LIST_STORE_REMOTE_FS_ICON_FIELD,
-				     icon, -1);
+				     icon, TASK_LIST_STORE_SRC_PATHS_FIELD,
+				     src_paths, -1);
 
   gtk_widget_set_sensitive (remove_tasks_button, TRUE);
 }
 
+static void
+elektroid_add_task (enum elektroid_task_type type, const char *src,
+		    const char *dst, gint remote_fs_id)
+{
+  elektroid_add_task_with_paths (type, src, NULL, dst, remote_fs_id);
+}
+
 static void
 elektroid_add_upload_task_path (const gchar * rel_path,
 				const gchar * src_dir,
@@ -2621,6 +2703,10 @@ elektroid_download_task (gpointer userdata)
       else
 	{
 	  transfer.status = CANCELED;
+	  if (transfer.fs_ops->save == package_save)
+	    {
+	      package_discard (&transfer.control);
+	    }
 	}
 
       g_byte_array_free (array, TRUE);
@@ -2637,6 +2723,138 @@ end_nodir:
   return NULL;
 }
 
+static gint
+elektroid_save_range_item (const gchar * path, guint index,
+			   GByteArray * array, struct job_control *control,
+			   void *data)
+{
+  GPtrArray *dst_paths = data;
+  const gchar *dst_path = g_ptr_array_index (dst_paths, index);
+
+  debug_print (1, "Writing %d bytes to file %s (filesystem %s)...\n",
+	       array->len, dst_path,
+	       elektroid_get_fs_name (transfer.fs_ops->fs));
+
+  return transfer.fs_ops->save (dst_path, array, control);
+}
+
+//The source of a range task is the remote directory, the remote paths are in the source paths and the destination is the local directory.
+static gpointer
+elektroid_download_range_task (gpointer userdata)
+{
+  gint res;
+  GPtrArray *paths, *dst_paths;
+
+  debug_print (1, "Remote dir: %s\n", transfer.src);
+  debug_print (1, "Local dir: %s\n", transfer.dst);
+
+  if (local_browser.fs_ops->mkdir (local_browser.backend, transfer.dst))
+    {
+      error_print ("Error while creating local %s dir\n", transfer.dst);
+      transfer.status = COMPLETED_ERROR;
+      goto end;
+    }
+
+  paths = g_ptr_array_new ();
+  for (gchar ** src_path = transfer.src_paths; *src_path; src_path++)
+    {
+      g_ptr_array_add (paths, *src_path);
+    }
+  dst_paths = g_ptr_array_new_with_free_func (g_free);
+
+  res = backend_get_download_range_paths (remote_browser.backend,
+					  transfer.fs_ops, paths,
+					  transfer.dst, dst_paths);
+  if (!res)
+    {
+      res = backend_download_range (remote_browser.backend, transfer.fs_ops,
+				    paths, elektroid_save_range_item,
+				    &transfer.control, dst_paths);
+    }
+  g_idle_add (elektroid_check_backend_bg, NULL);
+
+  g_mutex_lock (&transfer.control.mutex);
+  if (res && transfer.control.active)
+    {
+      error_print ("Error while downloading\n");
+      transfer.status = COMPLETED_ERROR;
+    }
+  else if (transfer.control.active)
+    {
+      transfer.status = COMPLETED_OK;
+    }
+  else
+    {
+      transfer.status = CANCELED;
+    }
+  g_mutex_unlock (&transfer.control.mutex);
+
+  g_ptr_array_free (paths, TRUE);
+  g_ptr_array_free (dst_paths, TRUE);
+
+end:
+  g_idle_add (elektroid_complete_running_task, NULL);
+  g_idle_add (elektroid_run_next_task, NULL);
+  return NULL;
+}
+
+//Several files in a slot storage filesystem are downloaded in a single task.
+static gboolean
+elektroid_add_download_range_task (GtkTreeModel * model, GList * rows)
+{
+  gchar *id, *path;
+  GList *row;
+  GPtrArray *src_paths;
+  struct item item;
+  GtkTreeIter iter;
+
+  if (!(remote_browser.fs_ops->options & FS_OPTION_SLOT_STORAGE)
+      || g_list_length (rows) < 2)
+    {
+      return FALSE;
+    }
+
+  for (row = rows; row; row = g_list_next (row))
+    {
+      gtk_tree_model_get_iter (model, &iter, row->data);
+      browser_set_item (model, &iter, &item);
+      if (item.type != ELEKTROID_FILE)
+	{
+	  return FALSE;
+	}
+    }
+
+  src_paths = g_ptr_array_new_with_free_func (g_free);
+  for (row = rows; row; row = g_list_next (row))
+    {
+      gtk_tree_model_get_iter (model, &iter, row->data);
+      browser_set_item (model, &iter, &item);
+      id = remote_browser.fs_ops->get_id (&item);
+      path = chain_path (remote_browser.dir, id);
+      if (file_matches_extensions (path, remote_browser.extensions))
+	{
+	  g_ptr_array_add (src_paths, path);
+	}
+      else
+	{
+	  g_free (path);
+	}
+      g_free (id);
+    }
+
+  if (src_paths->len)
+    {
+      g_ptr_array_add (src_paths, NULL);
+      elektroid_add_task_with_paths (DOWNLOAD_RANGE, remote_browser.dir,
+				     (gchar **) src_paths->pdata,
+				     local_browser.dir,
+				     remote_browser.fs_ops->fs);
+    }
+  g_ptr_array_free (src_paths, TRUE);
+
+  return TRUE;
+}
+
 static void
 elektroid_add_download_task_path (const gchar * rel_path,
 				  const gchar * src_dir,
@@ -2690,7 +2908,7 @@ elektroid_add_download_tasks_runner (gpointer data)
   GtkTreeIter iter;
   GList *selected_rows;
   struct item_iterator item_iterator;
-  gboolean queued_before, queued_after, active;
+  gboolean queued_before, queued_after, active, range;
   GtkTreeModel *model;
   GtkTreeSelection *selection;
 
@@ -2708,7 +2926,8 @@ elektroid_add_download_tasks_runner (gpointer data)
   remote_browser.fs_ops->readdir (remote_browser.backend, &item_iterator,
 				  remote_browser.dir);
   selected_rows = gtk_tree_selection_get_selected_rows (selection, NULL);
-  while (selected_rows)
+  range = elektroid_add_download_range_task (model, selected_rows);
+  while (selected_rows && !range)
     {
       gchar *id;
       struct item item;
@@ -4132,6 +4351,13 @@ main (int argc, char *argv[])
     }
 
   preferences_load (&preferences);
+  sample_set_quality (preferences.upload_quality);
+  sample_set_trim (preferences.trim, preferences.trim_threshold,
+		   preferences.trim_tail);
+  package_set_compression_level (preferences.package_compression_level);
+  sds_set_open_loop_margin (preferences.sds_open_loop_margin);
+  sds_set_scan (preferences.sds_scan);
+  elektron_set_os_upgrade_window (preferences.os_upgrade_window);
   if (local_dir)
     {
       g_free (preferences.local_dir);
@@ -302,6 +302,8 @@ local_sample_load_48_16_stereo (const gchar * path, GByteArray * sample,
   struct sample_params sample_params;
   sample_params.samplerate = 48000;
   sample_params.channels = 2;
+  sample_params.quality = SAMPLE_QUALITY_DEFAULT;
+  sample_params.trim = FALSE;
   return local_sample_load_custom (path, sample, control, &sample_params);
 }
 
@@ -312,6 +314,8 @@ local_sample_load_48_16_mono (const gchar * path, GByteArray * sample,
   struct sample_params sample_params;
   sample_params.samplerate = 48000;
   sample_params.channels = 1;
+  sample_params.quality = SAMPLE_QUALITY_DEFAULT;
+  sample_params.trim = FALSE;
   return local_sample_load_custom (path, sample, control, &sample_params);
 }
 
@@ -329,6 +333,8 @@ local_sample_load_441_16_stereo (const gchar * path, GByteArray * sample,
   struct sample_params sample_params;
   sample_params.samplerate = 44100;
   sample_params.channels = 2;
+  sample_params.quality = SAMPLE_QUALITY_DEFAULT;
+  sample_params.trim = FALSE;
   return local_sample_load_custom (path, sample, control, &sample_params);
 }
 
@@ -339,6 +345,8 @@ local_sample_load_441_16_mono (const gchar * path, GByteArray * sample,
   struct sample_params sample_params;
   sample_params.samplerate = 44100;
   sample_params.channels = 1;
+  sample_params.quality = SAMPLE_QUALITY_DEFAULT;
+  sample_params.trim = FALSE;
   return local_sample_load_custom (path, sample, control, &sample_params);
 }
 
@@ -465,7 +473,7 @@ const struct fs_operations FS_SYSTEM_SAMPLES_441_16_MONO_OPERATIONS = {
   .max_name_len = 255
 };
 
-static const struct fs_operations *FS_SYSTEM_OPERATIONS[] = {
+const struct fs_operations *FS_SYSTEM_OPERATIONS[] = {
   &FS_SYSTEM_SAMPLES_48_16_STEREO_OPERATIONS,
   &FS_SYSTEM_SAMPLES_48_16_MONO_OPERATIONS,
   &FS_SYSTEM_SAMPLES_441_16_STEREO_OPERATIONS,
@@ -27,6 +27,8 @@
 
 extern const struct fs_operations FS_LOCAL_OPERATIONS;
 
+extern const struct fs_operations *FS_SYSTEM_OPERATIONS[];
+
 gint system_handshake (struct backend *);
 
 #endif
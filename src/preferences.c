@@ -24,12 +24,47 @@
 #include <wordexp.h>
 #include "preferences.h"
 #include "utils.h"
+#include "sample.h"
+#include "connectors/sds.h"
+#include "connectors/elektron.h"
 
 #define PREFERENCES_FILE "/preferences.json"
 
 #define MEMBER_AUTOPLAY "autoplay"
 #define MEMBER_MIX "mix"
 #define MEMBER_LOCALDIR "localDir"
+#define MEMBER_PREVIEW_QUALITY "previewQuality"
+#define MEMBER_UPLOAD_QUALITY "uploadQuality"
+#define MEMBER_TRIM "trim"
+#define MEMBER_TRIM_THRESHOLD "trimThreshold"
+#define MEMBER_TRIM_TAIL "trimTail"
+#define MEMBER_PKG_COMPRESSION_LEVEL "packageCompressionLevel"
+#define MEMBER_SDS_OPEN_LOOP_MARGIN "sdsOpenLoopMargin"
+#define MEMBER_SDS_SCAN "sdsScan"
+#define MEMBER_OS_UPGRADE_WINDOW "osUpgradeWindow"
+
+#define DEFAULT_PREVIEW_QUALITY SAMPLE_QUALITY_MEDIUM
+#define DEFAULT_UPLOAD_QUALITY SAMPLE_QUALITY_BEST
+
+static enum sample_quality
+preferences_read_quality (JsonReader * reader, const gchar * member,
+			  enum sample_quality def)
+{
+  const gchar *name;
+  enum sample_quality quality = def;
+
+  if (json_reader_read_member (reader, member))
+    {
+      name = json_reader_get_string_value (reader);
+      if (!name || sample_parse_quality (name, &quality))
+	{
+	  quality = def;
+	}
+    }
+  json_reader_end_member (reader);
+
+  return quality;
+}
 
 gint
 preferences_save (struct preferences *preferences)
@@ -69,6 +104,38 @@ preferences_save (struct preferences *preferences)
   json_builder_set_member_name (builder, MEMBER_LOCALDIR);
   json_builder_add_string_value (builder, preferences->local_dir);
 
+  json_builder_set_member_name (builder, MEMBER_PREVIEW_QUALITY);
+  json_builder_add_string_value (builder,
+				 sample_get_quality_name
+				 (preferences->preview_quality));
+
+  json_builder_set_member_name (builder, MEMBER_UPLOAD_QUALITY);
+  json_builder_add_string_value (builder,
+				 sample_get_quality_name
+				 (preferences->upload_quality));
+
+  json_builder_set_member_name (builder, MEMBER_TRIM);
+  json_builder_add_boolean_value (builder, preferences->trim);
+
+  json_builder_set_member_name (builder, MEMBER_TRIM_THRESHOLD);
+  json_builder_add_double_value (builder, preferences->trim_threshold);
+
+  json_builder_set_member_name (builder, MEMBER_TRIM_TAIL);
+  json_builder_add_int_value (builder, preferences->trim_tail);
+
+  json_builder_set_member_name (builder, MEMBER_PKG_COMPRESSION_LEVEL);
+  json_builder_add_int_value (builder,
+			      preferences->package_compression_level);
+
+  json_builder_set_member_name (builder, MEMBER_SDS_OPEN_LOOP_MARGIN);
+  json_builder_add_int_value (builder, preferences->sds_open_loop_margin);
+
+  json_builder_set_member_name (builder, MEMBER_SDS_SCAN);
+  json_builder_add_boolean_value (builder, preferences->sds_scan);
+
+  json_builder_set_member_name (builder, MEMBER_OS_UPGRADE_WINDOW);
+  json_builder_add_int_value (builder, preferences->os_upgrade_window);
+
   json_builder_end_object (builder);
 
   gen = json_generator_new ();
@@ -107,6 +174,15 @@ preferences_load (struct preferences *preferences)
       preferences->autoplay = TRUE;
       preferences->mix = TRUE;
       preferences->local_dir = get_expanded_dir ("~");
+      preferences->preview_quality = DEFAULT_PREVIEW_QUALITY;
+      preferences->upload_quality = DEFAULT_UPLOAD_QUALITY;
+      preferences->trim = FALSE;
+      preferences->trim_threshold = SAMPLE_TRIM_DEFAULT_THRESHOLD;
+      preferences->trim_tail = SAMPLE_TRIM_DEFAULT_TAIL;
+      preferences->package_compression_level = 0;
+      preferences->sds_open_loop_margin = SDS_OPEN_LOOP_MARGIN_DEFAULT;
+      preferences->sds_scan = FALSE;
+      preferences->os_upgrade_window = OS_UPGRADE_WINDOW_DEFAULT;
       return 0;
     }
 
@@ -145,6 +221,84 @@ preferences_load (struct preferences *preferences)
     }
   json_reader_end_member (reader);
 
+  preferences->preview_quality =
+    preferences_read_quality (reader, MEMBER_PREVIEW_QUALITY,
+			      DEFAULT_PREVIEW_QUALITY);
+  preferences->upload_quality =
+    preferences_read_quality (reader, MEMBER_UPLOAD_QUALITY,
+			      DEFAULT_UPLOAD_QUALITY);
+
+  if (json_reader_read_member (reader, MEMBER_TRIM))
+    {
+      preferences->trim = json_reader_get_boolean_value (reader);
+    }
+  else
+    {
+      preferences->trim = FALSE;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_TRIM_THRESHOLD))
+    {
+      preferences->trim_threshold = json_reader_get_double_value (reader);
+    }
+  else
+    {
+      preferences->trim_threshold = SAMPLE_TRIM_DEFAULT_THRESHOLD;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_TRIM_TAIL))
+    {
+      preferences->trim_tail = MAX (0, json_reader_get_int_value (reader));
+    }
+  else
+    {
+      preferences->trim_tail = SAMPLE_TRIM_DEFAULT_TAIL;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_PKG_COMPRESSION_LEVEL))
+    {
+      preferences->package_compression_level =
+	json_reader_get_int_value (reader);
+    }
+  else
+    {
+      preferences->package_compression_level = 0;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_SDS_OPEN_LOOP_MARGIN))
+    {
+      preferences->sds_open_loop_margin = json_reader_get_int_value (reader);
+    }
+  else
+    {
+      preferences->sds_open_loop_margin = SDS_OPEN_LOOP_MARGIN_DEFAULT;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_SDS_SCAN))
+    {
+      preferences->sds_scan = json_reader_get_boolean_value (reader);
+    }
+  else
+    {
+      preferences->sds_scan = FALSE;
+    }
+  json_reader_end_member (reader);
+
+  if (json_reader_read_member (reader, MEMBER_OS_UPGRADE_WINDOW))
+    {
+      preferences->os_upgrade_window = json_reader_get_int_value (reader);
+    }
+  else
+    {
+      preferences->os_upgrade_window = OS_UPGRADE_WINDOW_DEFAULT;
+    }
+  json_reader_end_member (reader);
+
   g_object_unref (reader);
   g_object_unref (parser);
 
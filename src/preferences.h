@@ -19,12 +19,22 @@
  */
 
 #include <glib.h>
+#include "utils.h"
 
 struct preferences
 {
   gboolean autoplay;
   gboolean mix;
   gchar *local_dir;
+  enum sample_quality preview_quality;
+  enum sample_quality upload_quality;
+  gboolean trim;
+  gdouble trim_threshold;
+  gint trim_tail;
+  gint package_compression_level;
+  gint sds_open_loop_margin;
+  gboolean sds_scan;
+  gint os_upgrade_window;
 };
 
 gint preferences_save (struct preferences *);
@@ -23,10 +23,32 @@
 #include <samplerate.h>
 #include <inttypes.h>
 #include <math.h>
+#include <utime.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include "sample.h"
 
 #define JUNK_CHUNK_ID "JUNK"
 #define SMPL_CHUNK_ID "smpl"
+#define RIFF_CHUNK_ID "RIFF"
+#define WAVE_FORMAT_ID "WAVE"
+#define FMT_CHUNK_ID "fmt "
+#define DATA_CHUNK_ID "data"
+
+#define RIFF_HEADER_LEN 12
+#define CHUNK_HEADER_LEN 8
+#define FMT_CHUNK_MIN_LEN 16
+#define WAVE_FORMAT_PCM 1
+#define WAVE_HEADER_LEN (RIFF_HEADER_LEN + CHUNK_HEADER_LEN * 4 + \
+			 FMT_CHUNK_MIN_LEN + sizeof (JUNK_CHUNK_DATA) + \
+			 sizeof (struct smpl_chunk_data))
+
+#define CACHE_MAGIC "ELCS"
+#define CACHE_VERSION 2
+#define CACHE_MAX_SIZE (512 * 1024 * 1024)
+
+#define TRIM_THRESHOLD_SCALE 100	//The threshold is stored in hundredths of dB to be set atomically.
 
 static const gchar *ELEKTROID_AUDIO_LOCAL_EXTS[] =
   { "wav", "ogg", "aiff", "flac", NULL };
@@ -34,6 +56,21 @@ static const gchar *ELEKTROID_AUDIO_LOCAL_EXTS[] =
 static const gchar *ELEKTROID_AUDIO_LOCAL_EXTS_MP3[] =
   { "wav", "ogg", "aiff", "flac", "mp3", NULL };
 
+static const gchar *SAMPLE_QUALITY_NAMES[] =
+  { "default", "best", "medium", "fastest", "linear", NULL };
+
+static const gint SAMPLE_QUALITY_CONVERTERS[] = {
+  SRC_SINC_BEST_QUALITY, SRC_SINC_BEST_QUALITY, SRC_SINC_MEDIUM_QUALITY,
+  SRC_SINC_FASTEST, SRC_LINEAR
+};
+
+static gint sample_quality = SAMPLE_QUALITY_BEST;
+
+static gint sample_trim_enabled = FALSE;
+static gint sample_trim_threshold =
+  SAMPLE_TRIM_DEFAULT_THRESHOLD * TRIM_THRESHOLD_SCALE;
+static gint sample_trim_tail = SAMPLE_TRIM_DEFAULT_TAIL;
+
 struct smpl_chunk_data
 {
   guint32 manufacturer;
@@ -56,12 +93,38 @@ struct smpl_chunk_data
   } sample_loop;
 };
 
+// Converted samples are cached in CACHE_DIR. Every entry is this header
+// followed by the PCM data. As the cache never leaves the host, the native
+// byte order is used.
+struct sample_cache_header
+{
+  gchar magic[4];
+  guint32 version;
+  struct sample_info sample_info;
+  guint32 frames;
+  guint32 len;
+};
+
+struct sample_cache_entry
+{
+  gchar *path;
+  time_t mtime;
+  off_t size;
+};
+
 struct g_byte_array_io_data
 {
   GByteArray *array;
   guint pos;
 };
 
+struct mapped_io_data
+{
+  const guint8 *data;
+  sf_count_t len;
+  sf_count_t pos;
+};
+
 static const guint8 JUNK_CHUNK_DATA[] = {
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -150,22 +213,98 @@ static SF_VIRTUAL_IO G_BYTE_ARRAY_IO = {
   .tell = tell_byte_array_io
 };
 
+static sf_count_t
+get_filelen_mapped_io (void *user_data)
+{
+  struct mapped_io_data *data = user_data;
+  return data->len;
+}
+
+static sf_count_t
+seek_mapped_io (sf_count_t offset, int whence, void *user_data)
+{
+  struct mapped_io_data *data = user_data;
+  switch (whence)
+    {
+    case SEEK_SET:
+      data->pos = offset;
+      break;
+    case SEEK_CUR:
+      data->pos = data->pos + offset;
+      break;
+    case SEEK_END:
+      data->pos = data->len + offset;
+      break;
+    default:
+      break;
+    };
+
+  if (data->pos < 0)
+    {
+      data->pos = 0;
+    }
+  return data->pos;
+}
+
+static sf_count_t
+read_mapped_io (void *ptr, sf_count_t count, void *user_data)
+{
+  struct mapped_io_data *data = user_data;
+  if (data->pos >= data->len)
+    {
+      return 0;
+    }
+  if (data->pos + count > data->len)
+    {
+      count = data->len - data->pos;
+    }
+  memcpy (ptr, data->data + data->pos, count);
+  data->pos += count;
+  return count;
+}
+
+static sf_count_t
+write_mapped_io (const void *ptr, sf_count_t count, void *user_data)
+{
+  return 0;
+}
+
+static sf_count_t
+tell_mapped_io (void *user_data)
+{
+  struct mapped_io_data *data = user_data;
+  return data->pos;
+}
+
+static SF_VIRTUAL_IO MAPPED_IO = {
+  .get_filelen = get_filelen_mapped_io,
+  .seek = seek_mapped_io,
+  .read = read_mapped_io,
+  .write = write_mapped_io,
+  .tell = tell_mapped_io
+};
+
 static sf_count_t
 get_filelen_file_io (void *user_data)
 {
-  long fileSize, position;
+  long file_size, position;
   FILE *file = user_data;
-  position = fseek (file, 0, SEEK_END);
-  fileSize = ftell (file);
+  position = ftell (file);
+  fseek (file, 0, SEEK_END);
+  file_size = ftell (file);
   fseek (file, position, SEEK_SET);
-  return fileSize;
+  return file_size;
 }
 
 static sf_count_t
 seek_file_io (sf_count_t offset, int whence, void *user_data)
 {
   FILE *file = user_data;
-  return fseek (file, offset, whence);
+  if (fseek (file, offset, whence))
+    {
+      return -1;
+    }
+  return ftell (file);
 }
 
 static sf_count_t
@@ -197,126 +336,289 @@ static SF_VIRTUAL_IO FILE_IO = {
   .tell = tell_file_io
 };
 
-static gint
-sample_get_wave_data (GByteArray * sample, struct job_control *control,
-		      struct g_byte_array_io_data *wave)
+static guint8 *
+sample_put_le16 (guint8 * p, guint16 v)
 {
-  SF_INFO sf_info;
-  SNDFILE *sndfile;
-  sf_count_t frames, total;
-  struct SF_CHUNK_INFO junk_chunk_info;
-  struct SF_CHUNK_INFO smpl_chunk_info;
-  struct smpl_chunk_data smpl_chunk_data;
-  struct sample_info *sample_info = control->data;
+  v = htole16 (v);
+  memcpy (p, &v, sizeof (guint16));
+  return p + sizeof (guint16);
+}
 
-  g_byte_array_set_size (wave->array, sample->len + 1024);	//We need space for the headers.
-  wave->array->len = 0;
+static guint8 *
+sample_put_le32 (guint8 * p, guint32 v)
+{
+  v = htole32 (v);
+  memcpy (p, &v, sizeof (guint32));
+  return p + sizeof (guint32);
+}
 
-  frames = sample->len >> sample_info->channels;
-  debug_print (1, "Frames: %ld; sample rate: %d; channels: %d\n", frames,
-	       sample_info->samplerate, sample_info->channels);
-  debug_print (1, "Loop start at %d; loop end at %d\n",
-	       sample_info->loopstart, sample_info->loopend);
+static guint8 *
+sample_put_chunk_header (guint8 * p, const gchar * id, guint32 len)
+{
+  memcpy (p, id, 4);
+  return sample_put_le32 (p + 4, len);
+}
 
-  memset (&sf_info, 0, sizeof (sf_info));
-  sf_info.samplerate = sample_info->samplerate;
-  sf_info.channels = sample_info->channels;
-  sf_info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-  sndfile = sf_open_virtual (&G_BYTE_ARRAY_IO, SFM_WRITE, &sf_info, wave);
-  if (!sndfile)
-    {
-      error_print ("%s\n", sf_strerror (sndfile));
-      return -1;
-    }
+// Writes the RIFF header and every chunk up to the data chunk header. The PCM
+// data must follow it.
 
-  strcpy (junk_chunk_info.id, JUNK_CHUNK_ID);
-  junk_chunk_info.id_size = strlen (JUNK_CHUNK_ID);
-  junk_chunk_info.datalen = sizeof (JUNK_CHUNK_DATA);
-  junk_chunk_info.data = (void *) JUNK_CHUNK_DATA;
-  if (sf_set_chunk (sndfile, &junk_chunk_info) != SF_ERR_NO_ERROR)
-    {
-      error_print ("%s\n", sf_strerror (sndfile));
-    }
+static void
+sample_set_wave_header (guint8 * header, const struct sample_info *sample_info,
+			guint32 len)
+{
+  guint8 *p;
+
+  p = sample_put_chunk_header (header, RIFF_CHUNK_ID,
+			       WAVE_HEADER_LEN - CHUNK_HEADER_LEN + len);
+  memcpy (p, WAVE_FORMAT_ID, 4);
+  p += 4;
+
+  p = sample_put_chunk_header (p, FMT_CHUNK_ID, FMT_CHUNK_MIN_LEN);
+  p = sample_put_le16 (p, WAVE_FORMAT_PCM);
+  p = sample_put_le16 (p, sample_info->channels);
+  p = sample_put_le32 (p, sample_info->samplerate);
+  p = sample_put_le32 (p, sample_info->samplerate * sample_info->channels *
+		       sizeof (gint16));
+  p = sample_put_le16 (p, sample_info->channels * sizeof (gint16));
+  p = sample_put_le16 (p, 16);
+
+  p = sample_put_chunk_header (p, JUNK_CHUNK_ID, sizeof (JUNK_CHUNK_DATA));
+  memcpy (p, JUNK_CHUNK_DATA, sizeof (JUNK_CHUNK_DATA));
+  p += sizeof (JUNK_CHUNK_DATA);
+
+  p = sample_put_chunk_header (p, SMPL_CHUNK_ID,
+			       sizeof (struct smpl_chunk_data));
+  p = sample_put_le32 (p, 0);	//manufacturer
+  p = sample_put_le32 (p, 0);	//product
+  p = sample_put_le32 (p, 1e9 / sample_info->samplerate);	//sample_period
+  p = sample_put_le32 (p, 60);	//midi_unity_note
+  p = sample_put_le32 (p, 0);	//midi_pitch_fraction
+  p = sample_put_le32 (p, 0);	//smpte_format
+  p = sample_put_le32 (p, 0);	//smpte_offset
+  p = sample_put_le32 (p, 1);	//num_sampler_loops
+  p = sample_put_le32 (p, 0);	//sampler_data
+  p = sample_put_le32 (p, 0);	//cue_point_id
+  p = sample_put_le32 (p, sample_info->looptype);
+  p = sample_put_le32 (p, sample_info->loopstart);
+  p = sample_put_le32 (p, sample_info->loopend);
+  p = sample_put_le32 (p, 0);	//fraction
+  p = sample_put_le32 (p, 0);	//play_count
+
+  sample_put_chunk_header (p, DATA_CHUNK_ID, len);
+}
 
-  smpl_chunk_data.manufacturer = 0;
-  smpl_chunk_data.product = 0;
-  smpl_chunk_data.sample_period = 1e9 / sample_info->samplerate;
-  smpl_chunk_data.midi_unity_note = 60;
-  smpl_chunk_data.midi_pitch_fraction = 0;
-  smpl_chunk_data.smpte_format = 0;
-  smpl_chunk_data.smpte_offset = 0;
-  smpl_chunk_data.num_sampler_loops = 1;
-  smpl_chunk_data.sampler_data = 0;
-  smpl_chunk_data.sample_loop.cue_point_id = 0;
-  smpl_chunk_data.sample_loop.type = sample_info->looptype;
-  smpl_chunk_data.sample_loop.start = sample_info->loopstart;
-  smpl_chunk_data.sample_loop.end = sample_info->loopend;
-  smpl_chunk_data.sample_loop.fraction = 0;
-  smpl_chunk_data.sample_loop.play_count = 0;
-
-  strcpy (smpl_chunk_info.id, SMPL_CHUNK_ID);
-  smpl_chunk_info.id_size = strlen (SMPL_CHUNK_ID);
-  smpl_chunk_info.datalen = sizeof (struct smpl_chunk_data);
-  smpl_chunk_info.data = &smpl_chunk_data;
-  if (sf_set_chunk (sndfile, &smpl_chunk_info) != SF_ERR_NO_ERROR)
-    {
-      error_print ("%s\n", sf_strerror (sndfile));
-    }
+// WAV files are little endian. On big endian hosts, a swapped copy of the
+// sample is returned in copy and must be freed.
 
-  total = sf_writef_short (sndfile, (gint16 *) sample->data, frames);
-  sf_close (sndfile);
+static const guint8 *
+sample_get_le_data (GByteArray * sample, guint8 ** copy)
+{
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  guint16 *src = (guint16 *) sample->data;
+  guint16 *dst = g_malloc (sample->len);
 
-  if (total != frames)
+  for (guint i = 0; i < sample->len / sizeof (guint16); i++)
     {
-      error_print ("Unexpected frames while writing to file (%ld != %ld)\n",
-		   total, frames);
-      return -1;
+      dst[i] = GUINT16_SWAP_LE_BE (src[i]);
     }
+  *copy = (guint8 *) dst;
+  return *copy;
+#else
+  *copy = NULL;
+  return sample->data;
+#endif
+}
 
-  return 0;
+static void
+sample_print_wave_info (GByteArray * sample,
+			const struct sample_info *sample_info)
+{
+  debug_print (1, "Frames: %d; sample rate: %d; channels: %d\n",
+	       sample->len >> sample_info->channels, sample_info->samplerate,
+	       sample_info->channels);
+  debug_print (1, "Loop start at %d; loop end at %d\n",
+	       sample_info->loopstart, sample_info->loopend);
 }
 
 gint
 sample_get_wav_from_array (GByteArray * sample, GByteArray * wave,
 			   struct job_control *control)
 {
-  struct g_byte_array_io_data data;
-  data.pos = 0;
-  data.array = wave;
-  return sample_get_wave_data (sample, control, &data);
+  guint8 *copy;
+  struct sample_info *sample_info = control->data;
+
+  sample_print_wave_info (sample, sample_info);
+
+  g_byte_array_set_size (wave, WAVE_HEADER_LEN + sample->len);
+  sample_set_wave_header (wave->data, sample_info, sample->len);
+  memcpy (&wave->data[WAVE_HEADER_LEN], sample_get_le_data (sample, &copy),
+	  sample->len);
+  g_free (copy);
+
+  return 0;
 }
 
+// The header is built on the stack and the PCM data is written straight from
+// the sample.
+
 gint
 sample_save_from_array (const gchar * path, GByteArray * sample,
 			struct job_control *control)
 {
-  GByteArray *wave = g_byte_array_new ();
-  gint ret = sample_get_wav_from_array (sample, wave, control);
-  if (!ret)
+  gint fd, i, err = 0;
+  ssize_t written;
+  guint8 *copy;
+  guint8 header[WAVE_HEADER_LEN];
+  struct iovec iov[2];
+  struct sample_info *sample_info = control->data;
+
+  sample_print_wave_info (sample, sample_info);
+
+  sample_set_wave_header (header, sample_info, sample->len);
+
+  fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
     {
-      ret = save_file (path, wave, control);
+      return -errno;
     }
-  g_byte_array_free (wave, TRUE);
-  return ret;
+
+  debug_print (1, "Saving file %s...\n", path);
+
+  iov[0].iov_base = header;
+  iov[0].iov_len = WAVE_HEADER_LEN;
+  iov[1].iov_base = (void *) sample_get_le_data (sample, &copy);
+  iov[1].iov_len = sample->len;
+
+  i = 0;
+  while (i < 2)
+    {
+      written = writev (fd, &iov[i], 2 - i);
+      if (written < 0)
+	{
+	  if (errno == EINTR)
+	    {
+	      continue;
+	    }
+	  error_print ("Error while writing to file %s\n", path);
+	  err = -EIO;
+	  break;
+	}
+      while (i < 2 && written >= iov[i].iov_len)
+	{
+	  written -= iov[i].iov_len;
+	  i++;
+	}
+      if (i < 2)
+	{
+	  iov[i].iov_base = (guint8 *) iov[i].iov_base + written;
+	  iov[i].iov_len -= written;
+	}
+    }
+
+  if (close (fd) && !err)
+    {
+      err = -errno;
+    }
+  g_free (copy);
+
+  return err;
 }
 
-static void
-audio_multichannel_to_mono (gshort * input, gshort * output, gint size,
-			    gint channels)
+//The conversion kernels are plain loops that the compiler vectorizes. On x86,
+//a clone is built for every instruction set and the best one is picked at
+//runtime.
+
+#if defined(__GLIBC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define SAMPLE_KERNEL __attribute__((target_clones("avx2", "sse2", "default")))
+#endif
+#endif
+
+#ifndef SAMPLE_KERNEL
+#define SAMPLE_KERNEL
+#endif
+
+#define SAMPLE_SCALE_FLOAT 32768.0f
+
+SAMPLE_KERNEL static void
+sample_downmix_short (const gint16 * input, gint16 * output, gint frames,
+		      gint channels)
+{
+  gint i, j, v;
+
+  if (channels == 2)
+    {
+      for (i = 0; i < frames; i++)
+	{
+	  output[i] = (input[i * 2] + input[i * 2 + 1]) / 2;
+	}
+      return;
+    }
+
+  for (i = 0; i < frames; i++)
+    {
+      v = 0;
+      for (j = 0; j < channels; j++)
+	{
+	  v += input[i * channels + j];
+	}
+      output[i] = v / channels;
+    }
+}
+
+//Downmixing and conversion to float are done in the same pass.
+
+SAMPLE_KERNEL static void
+sample_downmix_float (const gint16 * input, gfloat * output, gint frames,
+		      gint channels)
 {
-  int i, j, v;
+  gint i, j, v;
+  gfloat scale = 1.0f / (SAMPLE_SCALE_FLOAT * channels);
 
-  debug_print (2, "Converting to mono...\n");
+  if (channels == 2)
+    {
+      for (i = 0; i < frames; i++)
+	{
+	  output[i] = (input[i * 2] + input[i * 2 + 1]) * scale;
+	}
+      return;
+    }
 
-  for (i = 0; i < size; i++)
+  for (i = 0; i < frames; i++)
     {
       v = 0;
       for (j = 0; j < channels; j++)
 	{
 	  v += input[i * channels + j];
 	}
-      v /= channels;
-      output[i] = v;
+      output[i] = v * scale;
+    }
+}
+
+SAMPLE_KERNEL static void
+sample_short_to_float (const gint16 * input, gfloat * output, gint len)
+{
+  gint i;
+
+  for (i = 0; i < len; i++)
+    {
+      output[i] = input[i] * (1.0f / SAMPLE_SCALE_FLOAT);
+    }
+}
+
+SAMPLE_KERNEL static void
+sample_float_to_short (const gfloat * input, gint16 * output, gint len)
+{
+  gint i;
+  gfloat v;
+
+  for (i = 0; i < len; i++)
+    {
+      v = input[i] * SAMPLE_SCALE_FLOAT;
+      v = v > SAMPLE_SCALE_FLOAT - 1 ? SAMPLE_SCALE_FLOAT - 1 : v;
+      v = v < -SAMPLE_SCALE_FLOAT ? -SAMPLE_SCALE_FLOAT : v;
+      output[i] = v < 0 ? v - 0.5f : v + 0.5f;
     }
 }
 
@@ -335,12 +637,13 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
   SRC_STATE *src_state;
   struct SF_CHUNK_INFO chunk_info;
   SF_CHUNK_ITERATOR *chunk_iter;
-  gint16 *buffer_input;
   gint16 *buffer_input_multi;
-  gint16 *buffer_input_mono;
-  gint16 *buffer_s;
+  gint16 *dst;
   gfloat *buffer_f;
   gint err, resampled_buffer_len, f, frames_read, channels, samplerate;
+  enum sample_quality quality;
+  gint64 start, elapsed;
+  guint capacity, loaded, produced, percent, last_percent, expected = 0;
   gboolean active;
   gdouble ratio;
   struct sample_info *sample_info;
@@ -357,6 +660,8 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
       g_mutex_unlock (&control->mutex);
     }
 
+  start = g_get_monotonic_time ();
+
   sf_info.format = 0;
   sndfile = sf_open_virtual (sf_virtual_io, SFM_READ, &sf_info, data);
   if (!sndfile)
@@ -386,6 +691,7 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
   sample_info->channels = sf_info.channels;
   sample_info->samplerate = sf_info.samplerate;
   sample_info->frames = sf_info.frames;
+  sample_info->trimmed = 0;
   if (control)
     {
       g_mutex_unlock (&control->mutex);
@@ -459,7 +765,6 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
 
   buffer_input_multi =
     malloc (LOAD_BUFFER_LEN * sf_info.channels * sizeof (gint16));
-  buffer_input_mono = malloc (LOAD_BUFFER_LEN * sizeof (gint16));
 
   buffer_f = malloc (LOAD_BUFFER_LEN * channels * sizeof (gfloat));
   src_data.data_in = buffer_f;
@@ -468,16 +773,41 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
 
   src_data.output_frames = ceil (LOAD_BUFFER_LEN * src_data.src_ratio);
   resampled_buffer_len = src_data.output_frames * channels;
-  buffer_s = malloc (resampled_buffer_len * sizeof (gint16));
   src_data.data_out = malloc (resampled_buffer_len * sizeof (gfloat));
 
-  src_state = src_new (SRC_SINC_BEST_QUALITY, channels, &err);
+  quality = sample_params->quality;
+  if (quality == SAMPLE_QUALITY_DEFAULT)
+    {
+      quality = g_atomic_int_get (&sample_quality);
+    }
+  if (samplerate != sf_info.samplerate)
+    {
+      debug_print (2, "Using %s resampler quality...\n",
+		   SAMPLE_QUALITY_NAMES[quality]);
+    }
+  src_state = src_new (SAMPLE_QUALITY_CONVERTERS[quality], channels, &err);
   if (err)
     {
       goto cleanup;
     }
 
-  *frames = sf_info.frames * src_data.src_ratio;
+  g_atomic_int_set (frames, sf_info.frames * src_data.src_ratio);
+  expected = *frames << channels;
+
+  //The whole output is reserved at once, with room for the frames added by
+  //the resampler due to rounding, so the data never moves while loading.
+  //Readers only need the length, which is published atomically.
+  capacity = expected + (src_data.output_frames << channels);
+  if (control)
+    {
+      g_mutex_lock (&control->mutex);
+    }
+  g_byte_array_set_size (sample, capacity);
+  g_byte_array_set_size (sample, 0);
+  if (control)
+    {
+      g_mutex_unlock (&control->mutex);
+    }
 
   if (samplerate != sf_info.samplerate)
     {
@@ -491,92 +821,105 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
 
   debug_print (2, "Loading sample (%" PRId64 " frames)...\n", sf_info.frames);
 
-  if (control)
-    {
-      g_mutex_lock (&control->mutex);
-      active = control->active;
-      g_mutex_unlock (&control->mutex);
-    }
-  else
-    {
-      active = TRUE;
-    }
+  active = control ? g_atomic_int_get (&control->active) : TRUE;
 
   f = 0;
+  loaded = 0;
+  last_percent = 0;
   while (f < sf_info.frames && active)
     {
       debug_print (2, "Loading %d channels buffer...\n", channels);
-      frames_read = sf_readf_short (sndfile, buffer_input_multi,
-				    LOAD_BUFFER_LEN);
-      f += frames_read;
+      dst = (gint16 *) & sample->data[loaded];
 
-      if (channels == sf_info.channels)	// 1 <= channels <= 2
+      if (samplerate == sf_info.samplerate && channels == sf_info.channels)
 	{
-	  buffer_input = buffer_input_multi;
+	  //There is nothing to convert so the frames are read in place.
+	  frames_read = sf_readf_short (sndfile, dst, LOAD_BUFFER_LEN);
+	  produced = frames_read;
 	}
       else
 	{
-	  audio_multichannel_to_mono (buffer_input_multi, buffer_input_mono,
-				      frames_read, sf_info.channels);
-	  buffer_input = buffer_input_mono;
-	}
+	  frames_read = sf_readf_short (sndfile, buffer_input_multi,
+					LOAD_BUFFER_LEN);
 
-      if (samplerate == sf_info.samplerate)
-	{
-	  if (control)
+	  if (samplerate == sf_info.samplerate)
 	    {
-	      g_mutex_lock (&control->mutex);
+	      debug_print (2, "Converting to mono...\n");
+	      sample_downmix_short (buffer_input_multi, dst, frames_read,
+				    sf_info.channels);
+	      produced = frames_read;
 	    }
-	  g_byte_array_append (sample, (guint8 *) buffer_input,
-			       frames_read << channels);
-	  if (control)
+	  else
 	    {
-	      g_mutex_unlock (&control->mutex);
+	      src_data.end_of_input =
+		frames_read < LOAD_BUFFER_LEN ? SF_TRUE : 0;
+	      src_data.input_frames = frames_read;
+
+	      if (channels == sf_info.channels)	// 1 <= channels <= 2
+		{
+		  sample_short_to_float (buffer_input_multi, buffer_f,
+					 frames_read * channels);
+		}
+	      else
+		{
+		  debug_print (2, "Converting to mono...\n");
+		  sample_downmix_float (buffer_input_multi, buffer_f,
+					frames_read, sf_info.channels);
+		}
+
+	      debug_print (2, "Resampling %d channels with ratio %f...\n",
+			   channels, src_data.src_ratio);
+	      err = src_process (src_state, &src_data);
+	      if (err)
+		{
+		  loaded = 0;
+		  g_atomic_int_set (&sample->len, 0);
+		  error_print ("Error while resampling: %s\n",
+			       src_strerror (err));
+		  break;
+		}
+	      produced = MIN (src_data.output_frames_gen,
+			      (capacity - loaded) >> channels);
+	      sample_float_to_short (src_data.data_out, dst,
+				     produced * channels);
 	    }
 	}
-      else
-	{
-	  src_data.end_of_input = frames_read < LOAD_BUFFER_LEN ? SF_TRUE : 0;
-	  src_data.input_frames = frames_read;
 
-	  src_short_to_float_array (buffer_input, buffer_f,
-				    frames_read * channels);
-	  debug_print (2, "Resampling %d channels with ratio %f...\n",
-		       channels, src_data.src_ratio);
-	  err = src_process (src_state, &src_data);
-	  if (err)
-	    {
-	      g_byte_array_set_size (sample, 0);
-	      error_print ("Error while resampling: %s\n",
-			   src_strerror (err));
-	      break;
-	    }
-	  src_float_to_short_array (src_data.data_out, buffer_s,
-				    src_data.output_frames_gen * channels);
-	  if (control)
-	    {
-	      g_mutex_lock (&control->mutex);
-	    }
-	  g_byte_array_append (sample, (guint8 *) buffer_s,
-			       src_data.output_frames_gen << channels);
-	  if (control)
-	    {
-	      g_mutex_unlock (&control->mutex);
-	    }
+      if (frames_read <= 0)
+	{
+	  break;
 	}
 
+      f += frames_read;
+      loaded += produced << channels;
+      g_atomic_int_set (&sample->len, loaded);
+
       if (control)
 	{
-	  g_mutex_lock (&control->mutex);
-	  set_job_control_progress_no_sync (control,
-					    f * 1.0 / sf_info.frames);
-	  active = control->active;
-	  g_mutex_unlock (&control->mutex);
+	  //Progress is only published when the percentage changes to keep the
+	  //lock out of the loop.
+	  percent = f * 100.0 / sf_info.frames;
+	  if (percent != last_percent)
+	    {
+	      last_percent = percent;
+	      set_job_control_progress (control, f / (double) sf_info.frames);
+	    }
+	  active = g_atomic_int_get (&control->active);
 	}
     }
 
   src_delete (src_state);
 
+  elapsed = g_get_monotonic_time () - start;
+  if (f && elapsed)
+    {
+      debug_print (1,
+		   "Loaded %d frames in %" PRId64
+		   " us (%s quality; real-time factor %.1f)\n", f, elapsed,
+		   SAMPLE_QUALITY_NAMES[quality],
+		   f * 1000000.0 / sf_info.samplerate / elapsed);
+    }
+
   if (control)
     {
       g_mutex_lock (&control->mutex);
@@ -595,8 +938,6 @@ sample_load_raw (void *data, SF_VIRTUAL_IO * sf_virtual_io,
 
 cleanup:
   free (buffer_input_multi);
-  free (buffer_input_mono);
-  free (buffer_s);
   free (buffer_f);
   free (src_data.data_out);
 
@@ -608,8 +949,12 @@ cleanup:
 	{
 	  control->data = sample_info;
 	}
-      // This removes the additional samples added by the resampler due to rounding.
-      g_byte_array_set_size (sample, *frames << channels);
+      // This removes the additional samples added by the resampler due to rounding or fills the missing ones.
+      if (sample->len < expected)
+	{
+	  memset (&sample->data[sample->len], 0, expected - sample->len);
+	}
+      g_atomic_int_set (&sample->len, expected);
       return 0;
     }
   else
@@ -622,6 +967,177 @@ cleanup:
     }
 }
 
+// Loads PCM data that needs no conversion at all and takes the same ownership
+// of control->data as sample_load_raw.
+
+static gint
+sample_load_pcm (struct job_control *control, GByteArray * sample,
+		 const struct sample_info *info, const guint8 * data,
+		 guint len, guint loaded_frames, guint * frames)
+{
+  struct sample_info *sample_info = control->data;
+
+  if (!control->data)
+    {
+      sample_info = g_malloc (sizeof (struct sample_info));
+    }
+
+  g_atomic_int_set (frames, loaded_frames);
+
+  g_mutex_lock (&control->mutex);
+  memcpy (sample_info, info, sizeof (struct sample_info));
+  g_byte_array_set_size (sample, len);
+  g_byte_array_set_size (sample, 0);
+  g_mutex_unlock (&control->mutex);
+
+  memcpy (sample->data, data, len);
+  g_atomic_int_set (&sample->len, len);
+
+  g_mutex_lock (&control->mutex);
+  if (control->active)
+    {
+      set_job_control_progress_no_sync (control, 1.0);
+    }
+  else
+    {
+      g_byte_array_set_size (sample, 0);
+    }
+  g_mutex_unlock (&control->mutex);
+
+  if (sample->len)
+    {
+      if (!control->data)
+	{
+	  control->data = sample_info;
+	}
+      return 0;
+    }
+  else
+    {
+      if (!control->data)
+	{
+	  g_free (sample_info);
+	}
+      return -1;
+    }
+}
+
+// PCM data that already is in the requested format is copied straight from
+// the RIFF container, skipping decoding and resampling. It returns 1 if the
+// data is not suitable, and the caller must then load it through libsndfile.
+
+static gint
+sample_load_pass_through (const guint8 * wave, gsize len,
+			  struct job_control *control, GByteArray * sample,
+			  const struct sample_params *sample_params,
+			  guint * frames)
+{
+  guint16 format = 0, channels = 0, block_align = 0, bits = 0;
+  guint32 id_pos, chunk_len, samplerate = 0, data_len = 0, pos;
+  const guint8 *data = NULL;
+  gboolean fmt = FALSE;
+  struct sample_info sample_info;
+  struct smpl_chunk_data smpl_chunk_data;
+  gboolean disable_loop = FALSE, smpl = FALSE;
+
+  if (G_BYTE_ORDER != G_LITTLE_ENDIAN || len < RIFF_HEADER_LEN ||
+      memcmp (wave, RIFF_CHUNK_ID, 4) || memcmp (&wave[8], WAVE_FORMAT_ID, 4))
+    {
+      return 1;
+    }
+
+  memset (&smpl_chunk_data, 0, sizeof (struct smpl_chunk_data));
+
+  pos = RIFF_HEADER_LEN;
+  while (pos + CHUNK_HEADER_LEN <= len)
+    {
+      memcpy (&chunk_len, &wave[pos + 4], sizeof (guint32));
+      chunk_len = le32toh (chunk_len);
+      id_pos = pos;
+      pos += CHUNK_HEADER_LEN;
+      if (chunk_len > len - pos)
+	{
+	  chunk_len = len - pos;
+	}
+
+      if (!memcmp (&wave[id_pos], FMT_CHUNK_ID, 4) &&
+	  chunk_len >= FMT_CHUNK_MIN_LEN)
+	{
+	  memcpy (&format, &wave[pos], sizeof (guint16));
+	  memcpy (&channels, &wave[pos + 2], sizeof (guint16));
+	  memcpy (&samplerate, &wave[pos + 4], sizeof (guint32));
+	  memcpy (&block_align, &wave[pos + 12], sizeof (guint16));
+	  memcpy (&bits, &wave[pos + 14], sizeof (guint16));
+	  format = le16toh (format);
+	  channels = le16toh (channels);
+	  samplerate = le32toh (samplerate);
+	  block_align = le16toh (block_align);
+	  bits = le16toh (bits);
+	  fmt = TRUE;
+	}
+      else if (!memcmp (&wave[id_pos], SMPL_CHUNK_ID, 4))
+	{
+	  memcpy (&smpl_chunk_data, &wave[pos],
+		  MIN (chunk_len, sizeof (struct smpl_chunk_data)));
+	  smpl = TRUE;
+	}
+      else if (!memcmp (&wave[id_pos], DATA_CHUNK_ID, 4))
+	{
+	  data = &wave[pos];
+	  data_len = chunk_len;
+	}
+
+      pos += chunk_len + (chunk_len & 1);
+    }
+
+  if (!fmt || !data || format != WAVE_FORMAT_PCM || bits != 16 ||
+      channels < 1 || channels > 2 || block_align != channels << 1 ||
+      (channels == 2 && sample_params->channels != 2) ||
+      (sample_params->samplerate && sample_params->samplerate != samplerate))
+    {
+      return 1;
+    }
+
+  debug_print (2, "Passing PCM data through...\n");
+
+  sample_info.channels = channels;
+  sample_info.samplerate = samplerate;
+  sample_info.frames = data_len / block_align;
+  sample_info.trimmed = 0;
+
+  if (smpl)
+    {
+      sample_info.loopstart = le32toh (smpl_chunk_data.sample_loop.start);
+      sample_info.loopend = le32toh (smpl_chunk_data.sample_loop.end);
+      sample_info.looptype = le32toh (smpl_chunk_data.sample_loop.type);
+      if (sample_info.loopstart >= sample_info.frames)
+	{
+	  debug_print (2, "Bad loop start\n");
+	  disable_loop = TRUE;
+	}
+      if (sample_info.loopend >= sample_info.frames)
+	{
+	  debug_print (2, "Bad loop end\n");
+	  disable_loop = TRUE;
+	}
+    }
+  else
+    {
+      disable_loop = TRUE;
+    }
+  if (disable_loop)
+    {
+      sample_info.loopstart = sample_info.frames - 1;
+      sample_info.loopend = sample_info.loopstart;
+      sample_info.looptype = 0;
+    }
+  sample_info.bitdepth = 16;
+
+  return sample_load_pcm (control, sample, &sample_info, data,
+			  sample_info.frames * block_align,
+			  sample_info.frames, frames);
+}
+
 gint
 sample_load_from_array (GByteArray * wave, GByteArray * sample,
 			struct job_control *control,
@@ -629,26 +1145,381 @@ sample_load_from_array (GByteArray * wave, GByteArray * sample,
 			guint * frames)
 {
   struct g_byte_array_io_data data;
+  gint err = sample_load_pass_through (wave->data, wave->len, control, sample,
+				       sample_params, frames);
+  if (err <= 0)
+    {
+      return err;
+    }
+
   data.pos = 0;
   data.array = wave;
   return sample_load_raw (&data, &G_BYTE_ARRAY_IO, control, sample,
 			  sample_params, frames);
 }
 
+// Entries are named after the hash of the source content and the parameters
+// of the conversion.
+
+static gchar *
+sample_get_cache_path (const guint8 * wave, gsize len,
+		       const struct sample_params *sample_params)
+{
+  gchar *path, *cache_dir, *hash;
+  enum sample_quality quality = sample_params->quality;
+
+  if (quality == SAMPLE_QUALITY_DEFAULT)
+    {
+      quality = sample_get_quality ();
+    }
+
+  hash = g_compute_checksum_for_data (G_CHECKSUM_SHA256, wave, len);
+  cache_dir = get_expanded_dir (CACHE_DIR);
+  path = g_strdup_printf ("%s/%s-%d-%d-16-%s", cache_dir, hash,
+			  sample_params->samplerate, sample_params->channels,
+			  SAMPLE_QUALITY_NAMES[quality]);
+  g_free (cache_dir);
+  g_free (hash);
+
+  return path;
+}
+
+static gint
+sample_load_from_cache (const gchar * path, struct job_control *control,
+			GByteArray * sample, guint * frames)
+{
+  gint err;
+  gsize len;
+  const guint8 *data;
+  struct sample_cache_header header;
+  GMappedFile *mapped_file = g_mapped_file_new (path, FALSE, NULL);
+
+  if (!mapped_file)
+    {
+      return -ENOENT;
+    }
+
+  data = (guint8 *) g_mapped_file_get_contents (mapped_file);
+  len = g_mapped_file_get_length (mapped_file);
+  if (len < sizeof (struct sample_cache_header))
+    {
+      err = -EINVAL;
+      goto end;
+    }
+
+  memcpy (&header, data, sizeof (struct sample_cache_header));
+  if (memcmp (header.magic, CACHE_MAGIC, 4) ||
+      header.version != CACHE_VERSION ||
+      header.len != len - sizeof (struct sample_cache_header))
+    {
+      error_print ("Invalid cache entry '%s'\n", path);
+      err = -EINVAL;
+      goto end;
+    }
+
+  debug_print (1, "Loading sample from cache entry '%s'...\n", path);
+
+  //The modification time is used as the last access time.
+  utime (path, NULL);
+
+  err = sample_load_pcm (control, sample, &header.sample_info,
+			 &data[sizeof (struct sample_cache_header)],
+			 header.len, header.frames, frames);
+
+end:
+  g_mapped_file_unref (mapped_file);
+  return err;
+}
+
+static gint
+sample_compare_cache_entries (gconstpointer a, gconstpointer b)
+{
+  const struct sample_cache_entry *ea = a;
+  const struct sample_cache_entry *eb = b;
+  return ea->mtime < eb->mtime ? -1 : ea->mtime > eb->mtime;
+}
+
+// The least recently used entries are removed until the cache fits in
+// CACHE_MAX_SIZE.
+
+static void
+sample_evict_cache (const gchar * cache_dir)
+{
+  GDir *dir;
+  guint i;
+  guint64 size;
+  struct stat st;
+  const gchar *name;
+  GArray *entries;
+  struct sample_cache_entry entry;
+
+  dir = g_dir_open (cache_dir, 0, NULL);
+  if (!dir)
+    {
+      return;
+    }
+
+  size = 0;
+  entries = g_array_new (FALSE, FALSE, sizeof (struct sample_cache_entry));
+  while ((name = g_dir_read_name (dir)))
+    {
+      entry.path = g_build_filename (cache_dir, name, NULL);
+      if (stat (entry.path, &st) || !S_ISREG (st.st_mode))
+	{
+	  g_free (entry.path);
+	  continue;
+	}
+      entry.mtime = st.st_mtime;
+      entry.size = st.st_size;
+      size += st.st_size;
+      g_array_append_val (entries, entry);
+    }
+  g_dir_close (dir);
+
+  if (size > CACHE_MAX_SIZE)
+    {
+      g_array_sort (entries, sample_compare_cache_entries);
+    }
+
+  for (i = 0; i < entries->len; i++)
+    {
+      struct sample_cache_entry *e = &g_array_index (entries,
+						     struct
+						     sample_cache_entry, i);
+      if (size > CACHE_MAX_SIZE)
+	{
+	  debug_print (1, "Evicting cache entry '%s'...\n", e->path);
+	  if (!unlink (e->path))
+	    {
+	      size -= e->size;
+	    }
+	}
+      g_free (e->path);
+    }
+
+  g_array_free (entries, TRUE);
+}
+
+static void
+sample_save_to_cache (const gchar * path, struct job_control *control,
+		      GByteArray * sample, guint frames)
+{
+  gint fd;
+  FILE *file;
+  gboolean ok;
+  gchar *cache_dir, *tmp_path;
+  struct sample_cache_header header;
+
+  cache_dir = get_expanded_dir (CACHE_DIR);
+  if (g_mkdir_with_parents (cache_dir, S_IRWXU))
+    {
+      error_print ("Error while creating directory '%s'\n", cache_dir);
+      g_free (cache_dir);
+      return;
+    }
+
+  memcpy (header.magic, CACHE_MAGIC, 4);
+  header.version = CACHE_VERSION;
+  g_mutex_lock (&control->mutex);
+  memcpy (&header.sample_info, control->data, sizeof (struct sample_info));
+  g_mutex_unlock (&control->mutex);
+  header.frames = frames;
+  header.len = sample->len;
+
+  //Entries are written to a temporary file and then renamed so that
+  //concurrent loads never see a partial entry.
+  tmp_path = g_strdup_printf ("%s.XXXXXX", path);
+  fd = g_mkstemp (tmp_path);
+  if (fd < 0)
+    {
+      error_print ("Error while creating cache entry '%s'\n", path);
+      goto end;
+    }
+
+  file = fdopen (fd, "w");
+  if (!file)
+    {
+      close (fd);
+      unlink (tmp_path);
+      goto end;
+    }
+
+  debug_print (1, "Saving sample to cache entry '%s'...\n", path);
+
+  ok = fwrite (&header, sizeof (struct sample_cache_header), 1, file) == 1 &&
+    fwrite (sample->data, 1, sample->len, file) == sample->len;
+  ok = !fclose (file) && ok;
+  if (!ok || rename (tmp_path, path))
+    {
+      error_print ("Error while saving cache entry '%s'\n", path);
+      unlink (tmp_path);
+    }
+
+  sample_evict_cache (cache_dir);
+
+end:
+  g_free (tmp_path);
+  g_free (cache_dir);
+}
+
+// Leading silence is removed completely and trailing silence is reduced to the
+// configured tail. A sample that is all silence is left untouched.
+
+static void
+sample_trim (GByteArray * sample, struct job_control *control,
+	     const struct sample_params *sample_params, guint * frames)
+{
+  gint16 *data = (gint16 *) sample->data;
+  gint threshold, channels, samplerate, c;
+  guint start, end, n, trimmed_frames, tail, bytes_per_frame;
+  struct sample_info *sample_info = control->data;
+
+  channels = sample_params->channels == 2 && sample_info->channels == 2 ?
+    2 : 1;
+  samplerate = sample_params->samplerate ? sample_params->samplerate :
+    sample_info->samplerate;
+  threshold = SAMPLE_SCALE_FLOAT *
+    pow (10, g_atomic_int_get (&sample_trim_threshold) /
+	 (20.0 * TRIM_THRESHOLD_SCALE));
+  tail = g_atomic_int_get (&sample_trim_tail) * (guint64) samplerate / 1000;
+  bytes_per_frame = channels * sizeof (gint16);
+  n = sample->len / bytes_per_frame;
+
+  for (start = 0; start < n; start++)
+    {
+      for (c = 0; c < channels; c++)
+	{
+	  if (ABS (data[start * channels + c]) > threshold)
+	    {
+	      break;
+	    }
+	}
+      if (c < channels)
+	{
+	  break;
+	}
+    }
+
+  if (start == n)
+    {
+      debug_print (1, "Sample is all silence. Not trimming...\n");
+      return;
+    }
+
+  for (end = n - 1; end > start; end--)
+    {
+      for (c = 0; c < channels; c++)
+	{
+	  if (ABS (data[end * channels + c]) > threshold)
+	    {
+	      break;
+	    }
+	}
+      if (c < channels)
+	{
+	  break;
+	}
+    }
+
+  end = MIN (n - 1, end + tail);
+  trimmed_frames = n - (end - start + 1);
+  if (!trimmed_frames)
+    {
+      return;
+    }
+
+  debug_print (1, "Trimming %d frames of silence (%d at the start)...\n",
+	       trimmed_frames, start);
+
+  n -= trimmed_frames;
+  memmove (sample->data, &sample->data[start * bytes_per_frame],
+	   n * bytes_per_frame);
+
+  g_mutex_lock (&control->mutex);
+  g_byte_array_set_size (sample, n * bytes_per_frame);
+  g_atomic_int_set (frames, n);
+  sample_info->trimmed = trimmed_frames * bytes_per_frame;
+  sample_info->loopstart = sample_info->loopstart < start ? 0 :
+    MIN (sample_info->loopstart - start, n - 1);
+  sample_info->loopend = sample_info->loopend < start ? 0 :
+    MIN (sample_info->loopend - start, n - 1);
+  g_mutex_unlock (&control->mutex);
+
+  debug_print (2, "Loop start at %d, loop end at %d after trimming\n",
+	       sample_info->loopstart, sample_info->loopend);
+}
+
 gint
 sample_load_from_file (const gchar * path, GByteArray * sample,
 		       struct job_control *control,
 		       const struct sample_params *sample_params,
 		       guint * frames)
 {
-  FILE *file = fopen (path, "rb");
-  if (!file)
+  FILE *file;
+  gint err;
+  const guint8 *wave;
+  gsize len;
+  gchar *cache_path = NULL;
+  struct mapped_io_data data;
+  GMappedFile *mapped_file = g_mapped_file_new (path, FALSE, NULL);
+
+  if (mapped_file)
     {
-      return errno;
+      wave = (guint8 *) g_mapped_file_get_contents (mapped_file);
+      len = g_mapped_file_get_length (mapped_file);
+      err = sample_load_pass_through (wave, len, control, sample,
+				      sample_params, frames);
+      if (err <= 0)
+	{
+	  goto end;
+	}
+
+      cache_path = sample_get_cache_path (wave, len, sample_params);
+      err = sample_load_from_cache (cache_path, control, sample, frames);
+      if (err != -ENOENT && err != -EINVAL)
+	{
+	  goto end;
+	}
+
+      if (len)
+	{
+	  madvise ((void *) wave, len, MADV_SEQUENTIAL);
+	}
+      data.data = wave;
+      data.len = len;
+      data.pos = 0;
+      err = sample_load_raw (&data, &MAPPED_IO, control, sample,
+			     sample_params, frames);
+    }
+  else
+    {
+      //Pipes and some network filesystems can not be mapped.
+      debug_print (1, "Reading '%s' without mapping it...\n", path);
+      file = fopen (path, "rb");
+      if (!file)
+	{
+	  return errno;
+	}
+      err = sample_load_raw (file, &FILE_IO, control, sample, sample_params,
+			     frames);
+      fclose (file);
+    }
+
+  if (!err && cache_path)
+    {
+      sample_save_to_cache (cache_path, control, sample, *frames);
+    }
+
+end:
+  if (!err && sample_params->trim && g_atomic_int_get (&sample_trim_enabled))
+    {
+      sample_trim (sample, control, sample_params, frames);
+    }
+  g_free (cache_path);
+  if (mapped_file)
+    {
+      g_mapped_file_unref (mapped_file);
     }
-  gint err = sample_load_raw (file, &FILE_IO, control, sample, sample_params,
-			      frames);
-  fclose (file);
   return err;
 }
 
@@ -676,3 +1547,55 @@ sample_get_sample_extensions ()
     }
   return ELEKTROID_AUDIO_LOCAL_EXTS;
 }
+
+void
+sample_set_quality (enum sample_quality quality)
+{
+  if (quality == SAMPLE_QUALITY_DEFAULT)
+    {
+      quality = SAMPLE_QUALITY_BEST;
+    }
+  debug_print (1, "Setting resampler quality to %s...\n",
+	       SAMPLE_QUALITY_NAMES[quality]);
+  g_atomic_int_set (&sample_quality, quality);
+}
+
+enum sample_quality
+sample_get_quality ()
+{
+  return g_atomic_int_get (&sample_quality);
+}
+
+gint
+sample_parse_quality (const gchar * name, enum sample_quality *quality)
+{
+  const gchar **n = &SAMPLE_QUALITY_NAMES[SAMPLE_QUALITY_BEST];
+  for (; *n; n++)
+    {
+      if (!strcmp (*n, name))
+	{
+	  *quality = n - SAMPLE_QUALITY_NAMES;
+	  return 0;
+	}
+    }
+  error_print ("Invalid resampler quality '%s'\n", name);
+  return -EINVAL;
+}
+
+const gchar *
+sample_get_quality_name (enum sample_quality quality)
+{
+  return SAMPLE_QUALITY_NAMES[quality];
+}
+
+void
+sample_set_trim (gboolean enabled, gdouble threshold, guint tail)
+{
+  debug_print (1,
+	       "Setting silence trimming to %s (threshold %.1f dBFS; tail %d ms)...\n",
+	       enabled ? "on" : "off", threshold, tail);
+  g_atomic_int_set (&sample_trim_enabled, enabled);
+  g_atomic_int_set (&sample_trim_threshold,
+		    lround (threshold * TRIM_THRESHOLD_SCALE));
+  g_atomic_int_set (&sample_trim_tail, tail);
+}
@@ -28,6 +28,9 @@
 
 #define LOAD_BUFFER_LEN 9600	// In guint16 frames; 0.2 ms
 
+#define SAMPLE_TRIM_DEFAULT_THRESHOLD -60.0	// In dBFS
+#define SAMPLE_TRIM_DEFAULT_TAIL 100	// In ms
+
 gint sample_get_wav_from_array (GByteArray *, GByteArray *,
 				struct job_control *);
 
@@ -42,4 +45,14 @@ gint sample_load_from_file (const gchar *, GByteArray *, struct job_control *,
 
 const gchar **sample_get_sample_extensions ();
 
+void sample_set_quality (enum sample_quality);
+
+enum sample_quality sample_get_quality ();
+
+gint sample_parse_quality (const gchar *, enum sample_quality *);
+
+const gchar *sample_get_quality_name (enum sample_quality);
+
+void sample_set_trim (gboolean, gdouble, guint);
+
 #endif
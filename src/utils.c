@@ -412,6 +412,19 @@ set_job_control_progress_no_sync (struct job_control *control, gdouble p)
     }
 }
 
+void
+set_sysex_transfer_progress (struct sysex_transfer *transfer, gdouble p)
+{
+  g_mutex_lock (&transfer->mutex);
+  transfer->progress = p;
+  g_mutex_unlock (&transfer->mutex);
+
+  if (transfer->callback)
+    {
+      transfer->callback (transfer);
+    }
+}
+
 gboolean
 file_matches_extensions (const gchar * name, gchar ** extensions)
 {
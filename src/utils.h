@@ -28,6 +28,7 @@
 #include "../config.h"
 
 #define CONF_DIR "~/.config/" PACKAGE
+#define CACHE_DIR "~/.cache/" PACKAGE
 
 #define LABEL_MAX 256
 
@@ -102,6 +103,17 @@ struct sample_info
   guint32 bitdepth;
   guint32 channels;
   guint32 frames;
+  guint32 trimmed;		//Bytes removed by the silence trimming.
+};
+
+// Resampler quality. The default one is whatever sample_set_quality set.
+enum sample_quality
+{
+  SAMPLE_QUALITY_DEFAULT = 0,
+  SAMPLE_QUALITY_BEST,
+  SAMPLE_QUALITY_MEDIUM,
+  SAMPLE_QUALITY_FASTEST,
+  SAMPLE_QUALITY_LINEAR
 };
 
 // This contains the format in which data must be load.
@@ -109,6 +121,8 @@ struct sample_params
 {
   guint32 channels;
   guint32 samplerate;
+  enum sample_quality quality;
+  gboolean trim;		//Only used by sample_load_from_file.
 };
 
 struct device_desc
@@ -128,6 +142,10 @@ enum sysex_transfer_status
   FINISHED
 };
 
+struct sysex_transfer;
+
+typedef void (*sysex_transfer_callback) (struct sysex_transfer *);
+
 struct sysex_transfer
 {
   gboolean active;
@@ -138,6 +156,8 @@ struct sysex_transfer
   gboolean batch;
   GByteArray *raw;
   gint err;
+  gdouble progress;		//Only set by transfers that know their length.
+  sysex_transfer_callback callback;
 };
 
 struct fs_operations;
@@ -153,6 +173,15 @@ typedef gint (*fs_src_dst_func) (struct backend *, const gchar *,
 typedef gint (*fs_remote_file_op) (struct backend *, const gchar *,
 				   GByteArray *, struct job_control *);
 
+// Called for every item of a range transfer. For downloads, it receives the downloaded data; for uploads, it must fill the
+// data to be sent. The unsigned integer is the position of the item in the range.
+typedef gint (*fs_range_item_func) (const gchar *, guint, GByteArray *,
+				    struct job_control *, void *);
+
+typedef gint (*fs_remote_range_op) (struct backend *, GPtrArray *,
+				    fs_range_item_func, struct job_control *,
+				    void *);
+
 typedef gchar *(*fs_get_item_id) (struct item *);
 
 typedef gchar *(*fs_get_item_slot) (struct item *, struct backend *);
@@ -174,10 +203,16 @@ typedef gchar *(*t_get_download_path) (struct backend *,
 
 typedef gint (*t_sysex_transfer) (struct backend *, struct sysex_transfer *);
 
+typedef gint (*t_upgrade_os) (struct backend *, const gchar *,
+			      struct sysex_transfer *);
+
 // All the function members that return gint should return 0 if no error and a negative number in case of error.
 // errno values are recommended as will provide the user with a meaningful message. In particular,
 // ENOSYS could be used when a particular device does not support a feature that other devices implementing the same filesystem do.
 
+// download_range and upload_range transfer a list of items in a single call. They are optional as the backend loops over
+// download and upload when they are not implemented. Connectors implement them to share the setup across the items.
+
 // rename and move are different operations. If move is implemented, rename must behave the same way. However, t's perfectly
 // possible to implement rename without implementing move. This is the case in slot mode filesystems.
 
@@ -199,8 +234,11 @@ struct fs_operations
   fs_src_dst_func copy;
   fs_path_func clear;
   fs_src_dst_func swap;
+  fs_path_func refresh;
   fs_remote_file_op download;
   fs_remote_file_op upload;
+  fs_remote_range_op download_range;
+  fs_remote_range_op upload_range;
   fs_get_item_id get_id;
   fs_get_item_slot get_slot;
   fs_local_file_op save;
@@ -264,6 +302,8 @@ void set_job_control_progress (struct job_control *, gdouble);
 
 void set_job_control_progress_no_sync (struct job_control *, gdouble);
 
+void set_sysex_transfer_progress (struct sysex_transfer *, gdouble);
+
 gboolean file_matches_extensions (const gchar *, gchar **);
 
 gboolean iter_matches_extensions (struct item_iterator *, gchar **);
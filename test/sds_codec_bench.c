@@ -0,0 +1,88 @@
+/*
+ *   sds_codec_bench.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Elektroid.
+ *
+ *   Elektroid is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Elektroid is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Elektroid. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "connectors/sds_codec.h"
+
+#define FRAMES (1024 * 1024)
+#define ROUNDS 16
+
+//Every kernel packs or unpacks the same buffer several times. Only the rates
+//are reported, so this never fails.
+
+static gdouble
+sds_codec_bench_rate (gint64 elapsed)
+{
+  return elapsed ? FRAMES * (gdouble) ROUNDS / elapsed : 0;
+}
+
+static void
+sds_codec_bench (guint bits)
+{
+  gint64 start, pack_time, unpack_time;
+  gint16 *frames;
+  guint8 *data;
+  struct sds_word_codec codec;
+
+  sds_get_word_codec (&codec, bits);
+
+  frames = g_malloc (FRAMES * sizeof (gint16));
+  data = g_malloc (FRAMES * codec.bytes_per_word);
+
+  for (guint i = 0; i < FRAMES; i++)
+    {
+      frames[i] = (gint16) (i * 7919);
+    }
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < ROUNDS; i++)
+    {
+      codec.pack (data, frames, FRAMES, codec.bits);
+    }
+  pack_time = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (guint i = 0; i < ROUNDS; i++)
+    {
+      codec.unpack (frames, data, FRAMES, codec.bits);
+    }
+  unpack_time = g_get_monotonic_time () - start;
+
+  printf ("%2d bits: pack %.1f Mwords/s; unpack %.1f Mwords/s\n", bits,
+	  sds_codec_bench_rate (pack_time),
+	  sds_codec_bench_rate (unpack_time));
+
+  g_free (frames);
+  g_free (data);
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const guint BITS[] = { 8, 12, 14, 16 };
+
+  for (guint i = 0; i < G_N_ELEMENTS (BITS); i++)
+    {
+      sds_codec_bench (BITS[i]);
+    }
+
+  return EXIT_SUCCESS;
+}
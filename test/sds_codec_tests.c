@@ -0,0 +1,103 @@
+/*
+ *   sds_codec_tests.c
+ *   Copyright (C) 2022 David García Goñi <dagargo@gmail.com>
+ *
+ *   This file is part of Elektroid.
+ *
+ *   Elektroid is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   Elektroid is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with Elektroid. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "connectors/sds_codec.h"
+
+#define FRAMES 0x10000		//Every 16 bits value
+
+//Every 16 bits value is packed and unpacked. Only the most significant bits of
+//the resolution must be kept and the packed bytes must be valid MIDI data.
+
+static gint
+sds_codec_test_round_trip (guint bits)
+{
+  gint err = 0;
+  gint16 *frames, *output, expected, mask;
+  guint8 *data;
+  struct sds_word_codec codec;
+
+  sds_get_word_codec (&codec, bits);
+
+  printf ("Testing %d bits codec...\n", bits);
+
+  if (codec.words_per_packet * codec.bytes_per_word >
+      SDS_DATA_PACKET_PAYLOAD_LEN)
+    {
+      printf ("Packet payload exceeded\n");
+      return 1;
+    }
+
+  frames = g_malloc (FRAMES * sizeof (gint16));
+  output = g_malloc (FRAMES * sizeof (gint16));
+  data = g_malloc (FRAMES * codec.bytes_per_word);
+
+  for (guint i = 0; i < FRAMES; i++)
+    {
+      frames[i] = (gint16) (i - 0x8000);
+    }
+
+  codec.pack (data, frames, FRAMES, codec.bits);
+
+  for (guint i = 0; i < FRAMES * codec.bytes_per_word; i++)
+    {
+      if (data[i] & 0x80)
+	{
+	  printf ("Byte %d is not a MIDI data byte (0x%02x)\n", i, data[i]);
+	  err = 1;
+	  goto end;
+	}
+    }
+
+  codec.unpack (output, data, FRAMES, codec.bits);
+
+  mask = (gint16) (0xffff << (16 - bits));
+  for (guint i = 0; i < FRAMES; i++)
+    {
+      expected = frames[i] & mask;
+      if (output[i] != expected)
+	{
+	  printf ("Frame %d: %d != %d\n", i, output[i], expected);
+	  err = 1;
+	  goto end;
+	}
+    }
+
+end:
+  g_free (frames);
+  g_free (output);
+  g_free (data);
+  return err;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint err = 0;
+  static const guint BITS[] = { 8, 12, 14, 16 };
+
+  for (guint i = 0; i < G_N_ELEMENTS (BITS); i++)
+    {
+      err |= sds_codec_test_round_trip (BITS[i]);
+    }
+
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}